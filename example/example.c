@@ -40,9 +40,9 @@ static void stdin_read_cb(struct ev_loop *loop, struct ev_io *w, int revents)
         buf[n - 1] = 0;
 
         if (buf[0] == 'q')
-            cl->send_close(cl, UWSC_CLOSE_STATUS_NORMAL, "ByeBye");
+            uwsc_send_close(cl, UWSC_CLOSE_STATUS_NORMAL, "ByeBye");
         else
-            cl->send(cl, buf, strlen(buf) + 1,  UWSC_OP_TEXT);
+            uwsc_send(cl, buf, strlen(buf) + 1,  UWSC_OP_TEXT);
     }
 }
 
@@ -58,7 +58,7 @@ static void uwsc_onopen(struct uwsc_client *cl)
     ev_io_start(cl->loop, &stdin_watcher);
 
     /* Usage of send_ex */
-    cl->send_ex(cl, UWSC_OP_TEXT,
+    uwsc_send_ex(cl, UWSC_OP_TEXT,
         2, strlen("hello,"), "hello,", strlen("server"), "server");
 
     printf("Please input:\n");
@@ -112,6 +112,7 @@ static void usage(const char *prog)
         "      -u url       # ws://localhost:8080/ws\n"
         "                     wss://localhost:8080/ws\n"
         "      -P n      	# Ping interval\n"
+        "      -z           # offer permessage-deflate\n"
         "      -d           # enable debug messages\n"
         , prog);
     exit(1);
@@ -123,10 +124,11 @@ int main(int argc, char **argv)
     struct ev_loop *loop = EV_DEFAULT;
     struct ev_signal signal_watcher;
     int ping_interval = 10;	/* second */
+    bool deflate = false;
     struct uwsc_client *cl;
     int opt;
 
-    while ((opt = getopt(argc, argv, "u:P:d:")) != -1) {
+    while ((opt = getopt(argc, argv, "u:P:d:z")) != -1) {
         switch (opt) {
         case 'u':
             url = optarg;
@@ -137,6 +139,9 @@ int main(int argc, char **argv)
         case 'd':
             log_level(LOG_DEBUG);
             break;
+        case 'z':
+            deflate = true;
+            break;
         default: /* '?' */
             usage(argv[0]);
         }
@@ -148,6 +153,14 @@ int main(int argc, char **argv)
     if (!cl)
         return -1;
 
+    if (deflate) {
+#ifdef DEFLATE_SUPPORT
+        uwsc_enable_deflate(cl, NULL);
+#else
+        log_err("permessage-deflate is not enabled at compile\n");
+#endif
+    }
+
     log_info("Start connect...\n");
 
     cl->onopen = uwsc_onopen;
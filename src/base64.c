@@ -0,0 +1,315 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "base64.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || __GNUC__ >= 5)
+#define B64_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static const char b64_alphabet[64] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+#define __ 0xff
+
+/* Character to its 6 bit value, 0xff outside the alphabet */
+static const uint8_t b64_values[256] = {
+    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,
+    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,
+    __, __, __, __, __, __, __, __, __, __, __, 62, __, __, __, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, __, __, __, __, __, __,
+    __,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, __, __, __, __, __,
+    __, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, __, __, __, __, __,
+    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,
+    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,
+    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,
+    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,
+    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,
+    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,
+    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,
+    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __
+};
+
+#undef __
+
+/*
+ * The vector loops handle the bulk and return how much input they
+ * consumed, the scalar code finishes the rest.
+ */
+typedef size_t (*b64_encode_blocks_t)(const uint8_t *src, size_t len, char *dest);
+typedef size_t (*b64_decode_blocks_t)(const char *src, size_t len, uint8_t *dest);
+
+static size_t b64_encode_blocks_none(const uint8_t *src, size_t len, char *dest)
+{
+    return 0;
+}
+
+static size_t b64_decode_blocks_none(const char *src, size_t len, uint8_t *dest)
+{
+    return 0;
+}
+
+#ifdef B64_X86
+/*
+ * 12 bytes to 16 characters per round, by Wojciech Muła and Daniel Lemire,
+ * "Faster Base64 Encoding and Decoding using AVX2 Instructions", 2018.
+ * Each load reads 16 bytes, so the loop stops 4 bytes early.
+ */
+__attribute__((target("ssse3")))
+static size_t b64_encode_blocks_ssse3(const uint8_t *src, size_t len, char *dest)
+{
+    const __m128i shuf = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    size_t done = 0;
+
+    while (len - done >= 16) {
+        __m128i in = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + done)), shuf);
+        __m128i t0, t1, idx, res, less;
+
+        /* Split every 3 bytes into four 6 bit indices, one per byte */
+        t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+        t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+        idx = _mm_or_si128(t0, t1);
+
+        /* Index to the offset of its alphabet range */
+        res = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+        less = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+        res = _mm_or_si128(res, _mm_and_si128(less, _mm_set1_epi8(13)));
+        res = _mm_add_epi8(_mm_shuffle_epi8(offsets, res), idx);
+
+        _mm_storeu_si128((__m128i *)dest, res);
+
+        done += 12;
+        dest += 16;
+    }
+
+    return done;
+}
+
+/*
+ * 16 characters to 12 bytes per round, same authors. A round with any
+ * character outside the alphabet, padding included, is left to the scalar
+ * code. Each store writes 16 bytes, so the loop stops 8 characters early
+ * to stay within what the whole input decodes to.
+ */
+__attribute__((target("ssse3")))
+static size_t b64_decode_blocks_ssse3(const char *src, size_t len, uint8_t *dest)
+{
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+        0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m128i mask_2f = _mm_set1_epi8(0x2f);
+    size_t done = 0;
+
+    while (len - done >= 24) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(src + done));
+        __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask_2f);
+        __m128i lo = _mm_shuffle_epi8(lut_lo, _mm_and_si128(in, mask_2f));
+        __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+        __m128i roll;
+
+        if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())))
+            break;
+
+        /* Character to its 6 bit value */
+        roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(in, mask_2f), hi_nibbles));
+        in = _mm_add_epi8(in, roll);
+
+        /* Four 6 bit values to 3 bytes */
+        in = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+        in = _mm_madd_epi16(in, _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128((__m128i *)dest, _mm_shuffle_epi8(in, pack));
+
+        done += 16;
+        dest += 12;
+    }
+
+    return done;
+}
+
+static bool b64_has_ssse3(void)
+{
+    unsigned int a, b, c, d;
+
+    return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSSE3);
+}
+#endif
+
+static b64_encode_blocks_t b64_encode_blocks = b64_encode_blocks_none;
+static b64_decode_blocks_t b64_decode_blocks = b64_decode_blocks_none;
+static bool b64_resolved;
+
+/* Pick the vector loops for this CPU on first use */
+static void b64_resolve(void)
+{
+    b64_encode_blocks_t enc = b64_encode_blocks_none;
+    b64_decode_blocks_t dec = b64_decode_blocks_none;
+
+    if (__atomic_load_n(&b64_resolved, __ATOMIC_ACQUIRE))
+        return;
+
+#ifdef B64_X86
+    if (b64_has_ssse3()) {
+        enc = b64_encode_blocks_ssse3;
+        dec = b64_decode_blocks_ssse3;
+    }
+#endif
+
+    b64_encode_blocks = enc;
+    b64_decode_blocks = dec;
+    __atomic_store_n(&b64_resolved, true, __ATOMIC_RELEASE);
+}
+
+size_t b64_encode_exact(const void *src, size_t len, char *dest)
+{
+    const uint8_t *in = src;
+    char *out = dest;
+    size_t done;
+
+    b64_resolve();
+
+    done = b64_encode_blocks(in, len, out);
+    in += done;
+    out += done / 3 * 4;
+    len -= done;
+
+    for (; len >= 3; len -= 3) {
+        uint32_t v = in[0] << 16 | in[1] << 8 | in[2];
+
+        out[0] = b64_alphabet[v >> 18];
+        out[1] = b64_alphabet[(v >> 12) & 0x3f];
+        out[2] = b64_alphabet[(v >> 6) & 0x3f];
+        out[3] = b64_alphabet[v & 0x3f];
+
+        in += 3;
+        out += 4;
+    }
+
+    if (len > 0) {
+        uint32_t v = in[0] << 16 | (len > 1 ? in[1] << 8 : 0);
+
+        out[0] = b64_alphabet[v >> 18];
+        out[1] = b64_alphabet[(v >> 12) & 0x3f];
+        out[2] = len > 1 ? b64_alphabet[(v >> 6) & 0x3f] : '=';
+        out[3] = '=';
+        out += 4;
+    }
+
+    return out - dest;
+}
+
+ssize_t b64_decoded_len(const char *src, size_t len)
+{
+    if (len % 4)
+        return -1;
+
+    if (len == 0)
+        return 0;
+
+    return len / 4 * 3 - (src[len - 1] == '=') - (src[len - 2] == '=');
+}
+
+ssize_t b64_decode(const char *src, size_t len, void *dest)
+{
+    ssize_t total = b64_decoded_len(src, len);
+    const uint8_t *in = (const uint8_t *)src;
+    uint8_t *out = dest;
+    size_t done;
+
+    if (total <= 0)
+        return total;
+
+    b64_resolve();
+
+    done = b64_decode_blocks(src, len, out);
+    in += done;
+    out += done / 4 * 3;
+    len -= done;
+
+    for (; len > 4; len -= 4) {
+        uint32_t a = b64_values[in[0]], b = b64_values[in[1]];
+        uint32_t c = b64_values[in[2]], d = b64_values[in[3]];
+
+        if ((a | b | c | d) & 0x80)
+            return -1;
+
+        out[0] = a << 2 | b >> 4;
+        out[1] = b << 4 | c >> 2;
+        out[2] = c << 6 | d;
+
+        in += 4;
+        out += 3;
+    }
+
+    /* The last quantum, it may be padded */
+    {
+        uint32_t a = b64_values[in[0]], b = b64_values[in[1]];
+        uint32_t c = in[2] == '=' ? 0 : b64_values[in[2]];
+        uint32_t d = in[3] == '=' ? 0 : b64_values[in[3]];
+
+        if ((a | b | c | d) & 0x80)
+            return -1;
+
+        /* "==" only at the end, and the bits padding drops must be zero */
+        if (in[2] == '=' && (in[3] != '=' || (b & 0x0f)))
+            return -1;
+
+        if (in[3] == '=' && in[2] != '=' && (c & 0x03))
+            return -1;
+
+        out[0] = a << 2 | b >> 4;
+        if (in[2] != '=')
+            out[1] = b << 4 | c >> 2;
+        if (in[3] != '=')
+            out[2] = c << 6 | d;
+    }
+
+    return total;
+}
+
+int b64_encode(const void *src, size_t srclen, void *dest, size_t destsize)
+{
+    size_t len = b64_encoded_len(srclen);
+
+    if (destsize < len + 1)
+        return -1;
+
+    b64_encode_exact(src, srclen, dest);
+    ((char *)dest)[len] = '\0';
+
+    return len;
+}
@@ -0,0 +1,55 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _BASE64_H
+#define _BASE64_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Base64 with the standard alphabet and padding, RFC 4648 section 4 */
+
+/* Length of the encoding of @len bytes */
+static inline size_t b64_encoded_len(size_t len)
+{
+    return (len + 2) / 3 * 4;
+}
+
+/* Length @src of @len characters decodes to, or -1 if @len isn't a multiple of 4 */
+ssize_t b64_decoded_len(const char *src, size_t len);
+
+/* Write exactly b64_encoded_len(@len) characters to @dest, without a terminating '\0' */
+size_t b64_encode_exact(const void *src, size_t len, char *dest);
+
+/*
+ * Decode @len characters into @dest, which must hold b64_decoded_len(@src, @len)
+ * bytes. Return that length, or -1 on characters outside the alphabet,
+ * misplaced padding or a wrong length. Whitespace is not skipped.
+ */
+ssize_t b64_decode(const char *src, size_t len, void *dest);
+
+/* Encode and terminate with '\0'. Return the length or -1 if @destsize is too small */
+int b64_encode(const void *src, size_t srclen, void *dest, size_t destsize);
+
+#endif
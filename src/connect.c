@@ -0,0 +1,221 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+
+#include "uwsc.h"
+#include "utils.h"
+#include "connect.h"
+
+/* Alternate between address families, starting with the preferred first one (RFC 8305 section 4) */
+static void connector_interleave(union dns_addr *addrs, int n)
+{
+    union dns_addr first[DNS_MAX_ADDRS], other[DNS_MAX_ADDRS];
+    int nfirst = 0, nother = 0;
+    int i, j, k;
+
+    if (n < 2)
+        return;
+
+    for (i = 0; i < n; i++) {
+        if (addrs[i].sa.sa_family == addrs[0].sa.sa_family)
+            first[nfirst++] = addrs[i];
+        else
+            other[nother++] = addrs[i];
+    }
+
+    for (i = 0, j = 0, k = 0; i < n; i++) {
+        if ((i % 2 == 0 || k == nother) && j < nfirst)
+            addrs[i] = first[j++];
+        else
+            addrs[i] = other[k++];
+    }
+}
+
+static void connector_stop(struct connector *c, int keep)
+{
+    int i;
+
+    ev_timer_stop(c->loop, &c->timer);
+
+    for (i = 0; i < c->next; i++) {
+        struct ev_io *w = &c->attempts[i];
+
+        if (!ev_is_active(w))
+            continue;
+
+        ev_io_stop(c->loop, w);
+        if (w->fd != keep)
+            close(w->fd);
+    }
+
+    c->running = 0;
+}
+
+static void connector_fail(struct connector *c)
+{
+    c->err = UWSC_ERROR_CONNECT;
+    c->errmsg = strerror(c->last_errno);
+}
+
+static void connector_io_cb(struct ev_loop *loop, struct ev_io *w, int revents);
+
+/* Start the next attempt that gets past connect(), return false if none is left */
+static bool connector_attempt(struct connector *c)
+{
+    while (c->next < c->dns.naddrs) {
+        union dns_addr *addr = &c->dns.addrs[c->next];
+        struct ev_io *w = &c->attempts[c->next++];
+        bool inprogress;
+        int sock;
+
+        sock = tcp_connect_addr(&addr->sa, dns_addr_len(addr), SOCK_NONBLOCK | SOCK_CLOEXEC, &inprogress);
+        if (sock < 0) {
+            c->last_errno = errno;
+            continue;
+        }
+
+        /* Also covers a connect that completed right away, the socket is writable */
+        ev_io_set(w, sock, EV_WRITE);
+        ev_io_start(c->loop, w);
+        c->running++;
+
+        if (c->next < c->dns.naddrs) {
+            ev_timer_stop(c->loop, &c->timer);
+            ev_timer_set(&c->timer, CONNECT_ATTEMPT_DELAY, 0.0);
+            ev_timer_start(c->loop, &c->timer);
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+static void connector_io_cb(struct ev_loop *loop, struct ev_io *w, int revents)
+{
+    struct connector *c = w->data;
+    socklen_t optlen = sizeof(int);
+    int sock = w->fd;
+    int err = 0;
+
+    getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &optlen);
+    if (!err) {
+        connector_stop(c, sock);
+        c->cb(c, sock);
+        return;
+    }
+
+    ev_io_stop(loop, w);
+    close(sock);
+    c->running--;
+    c->last_errno = err;
+
+    /* Don't wait for the timer, a failed attempt hands over right away */
+    if (connector_attempt(c) || c->running > 0)
+        return;
+
+    connector_fail(c);
+    c->cb(c, -1);
+}
+
+static void connector_timer_cb(struct ev_loop *loop, struct ev_timer *w, int revents)
+{
+    struct connector *c = container_of(w, struct connector, timer);
+
+    if (connector_attempt(c) || c->running > 0)
+        return;
+
+    connector_fail(c);
+    c->cb(c, -1);
+}
+
+static int connector_connect(struct connector *c)
+{
+    if (c->dns.error) {
+        c->err = UWSC_ERROR_RESOLVE;
+        c->errmsg = gai_strerror(c->dns.error);
+        return -1;
+    }
+
+    connector_interleave(c->dns.addrs, c->dns.naddrs);
+
+    if (!connector_attempt(c)) {
+        connector_fail(c);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void connector_resolved(struct dns_query *q)
+{
+    struct connector *c = container_of(q, struct connector, dns);
+
+    if (connector_connect(c) < 0)
+        c->cb(c, -1);
+}
+
+int connector_start(struct connector *c, struct ev_loop *loop, const char *host, int port,
+    void (*cb)(struct connector *c, int sock))
+{
+    int i, ret;
+
+    c->loop = loop;
+    c->cb = cb;
+    c->next = 0;
+    c->running = 0;
+    c->last_errno = ECONNREFUSED;
+    c->err = 0;
+    c->errmsg = NULL;
+
+    ev_timer_init(&c->timer, connector_timer_cb, CONNECT_ATTEMPT_DELAY, 0.0);
+
+    for (i = 0; i < DNS_MAX_ADDRS; i++) {
+        ev_io_init(&c->attempts[i], connector_io_cb, -1, EV_WRITE);
+        c->attempts[i].data = c;
+    }
+
+    ret = dns_resolve(loop, &c->dns, host, port, connector_resolved);
+    if (ret < 0) {
+        c->err = UWSC_ERROR_RESOLVE;
+        c->errmsg = "Failed to start the lookup";
+        return -1;
+    }
+
+    /* Answered from the cache or a numeric host */
+    if (ret == 0)
+        return connector_connect(c);
+
+    return 0;
+}
+
+void connector_cancel(struct connector *c)
+{
+    dns_cancel(&c->dns);
+    connector_stop(c, -1);
+}
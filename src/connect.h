@@ -0,0 +1,68 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _CONNECT_H
+#define _CONNECT_H
+
+#include "resolver.h"
+
+/* Time between staggered connection attempts, see RFC 8305 */
+#define CONNECT_ATTEMPT_DELAY   0.25
+
+/*
+ * Resolves a host and races connections to its addresses (Happy Eyeballs).
+ * Addresses are tried alternating between families, a new attempt starts
+ * every CONNECT_ATTEMPT_DELAY or as soon as one fails, and the first
+ * connection to complete wins.
+ */
+struct connector {
+    struct ev_loop *loop;
+    struct dns_query dns;
+    struct ev_timer timer;
+    struct ev_io attempts[DNS_MAX_ADDRS];
+    int next;               /* Next address to try */
+    int running;            /* Attempts in flight */
+    int last_errno;
+    int err;                /* UWSC_ERROR_RESOLVE or UWSC_ERROR_CONNECT once failed */
+    const char *errmsg;
+    void (*cb)(struct connector *c, int sock);
+    void *data;
+};
+
+/*
+ *  connector_start - resolve @host and connect to @port
+ *
+ *  @cb gets the connected socket, or -1 with err and errmsg set. It is always
+ *  called from @loop and never before connector_start returns.
+ *
+ *  Return 0 if the connect is under way, -1 with err and errmsg set if it
+ *  failed right away.
+ */
+int connector_start(struct connector *c, struct ev_loop *loop, const char *host, int port,
+    void (*cb)(struct connector *c, int sock));
+
+/* Abort, @cb will not be called */
+void connector_cancel(struct connector *c);
+
+#endif
@@ -0,0 +1,224 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "csprng.h"
+
+#define CSPRNG_BLOCKS           8
+#define CSPRNG_BATCH            (CSPRNG_BLOCKS * 64)
+#define CSPRNG_RESEED_BYTES     (1024 * 1024)
+
+struct csprng {
+    uint32_t key[8];
+    uint32_t nonce[3];
+    uint32_t counter;
+    uint8_t batch[CSPRNG_BATCH];
+    size_t avail;           /* Unused bytes at the end of batch */
+    size_t output;          /* Bytes handed out since the last seed */
+    unsigned int fork_gen;  /* Value of fork_gen when seeded */
+    bool seeded;
+};
+
+static __thread struct csprng rng;
+
+/* Bumped in the child after fork, so that every thread state reseeds */
+static volatile unsigned int fork_gen;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static void csprng_atfork_child(void)
+{
+    fork_gen++;
+}
+
+static void csprng_atfork_register(void)
+{
+    pthread_atfork(NULL, NULL, csprng_atfork_child);
+}
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d)                    \
+    do {                                            \
+        a += b; d ^= a; d = ROTL32(d, 16);          \
+        c += d; b ^= c; b = ROTL32(b, 12);          \
+        a += b; d ^= a; d = ROTL32(d, 8);           \
+        c += d; b ^= c; b = ROTL32(b, 7);           \
+    } while (0)
+
+/* RFC 7539 ChaCha20 block function */
+static void chacha20_block(const uint32_t key[8], uint32_t counter,
+    const uint32_t nonce[3], uint8_t out[64])
+{
+    uint32_t in[16] = {
+        0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+        key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+        counter, nonce[0], nonce[1], nonce[2]
+    };
+    uint32_t x[16];
+    int i;
+
+    memcpy(x, in, sizeof(x));
+
+    for (i = 0; i < 10; i++) {
+        QUARTERROUND(x[0], x[4], x[8], x[12]);
+        QUARTERROUND(x[1], x[5], x[9], x[13]);
+        QUARTERROUND(x[2], x[6], x[10], x[14]);
+        QUARTERROUND(x[3], x[7], x[11], x[15]);
+        QUARTERROUND(x[0], x[5], x[10], x[15]);
+        QUARTERROUND(x[1], x[6], x[11], x[12]);
+        QUARTERROUND(x[2], x[7], x[8], x[13]);
+        QUARTERROUND(x[3], x[4], x[9], x[14]);
+    }
+
+    for (i = 0; i < 16; i++) {
+        uint32_t v = x[i] + in[i];
+
+        out[i * 4 + 0] = v;
+        out[i * 4 + 1] = v >> 8;
+        out[i * 4 + 2] = v >> 16;
+        out[i * 4 + 3] = v >> 24;
+    }
+}
+
+static int csprng_entropy(void *buf, size_t len)
+{
+    uint8_t *p = buf;
+    int fd;
+
+#ifdef SYS_getrandom
+    while (len > 0) {
+        long n = syscall(SYS_getrandom, p, len, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        p += n;
+        len -= n;
+    }
+
+    if (len == 0)
+        return 0;
+#endif
+
+    /* Old kernel without getrandom */
+    fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            close(fd);
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+
+    close(fd);
+    return 0;
+}
+
+static int csprng_seed(struct csprng *r)
+{
+    uint32_t seed[11];
+
+    pthread_once(&atfork_once, csprng_atfork_register);
+
+    if (csprng_entropy(seed, sizeof(seed)) < 0)
+        return -1;
+
+    memcpy(r->key, seed, sizeof(r->key));
+    memcpy(r->nonce, seed + 8, sizeof(r->nonce));
+    memset(seed, 0, sizeof(seed));
+
+    r->counter = 0;
+    r->avail = 0;
+    r->output = 0;
+    r->fork_gen = fork_gen;
+    r->seeded = true;
+
+    return 0;
+}
+
+/*
+ * Generate a new batch. The first 32 bytes of every batch rekey the
+ * generator and are never handed out, so a later compromise of the
+ * state does not reveal earlier output.
+ */
+static void csprng_refill(struct csprng *r)
+{
+    int i;
+
+    for (i = 0; i < CSPRNG_BLOCKS; i++)
+        chacha20_block(r->key, r->counter++, r->nonce, r->batch + i * 64);
+
+    memcpy(r->key, r->batch, sizeof(r->key));
+    memset(r->batch, 0, sizeof(r->key));
+
+    r->avail = CSPRNG_BATCH - sizeof(r->key);
+}
+
+int csprng_bytes(void *buf, size_t len)
+{
+    struct csprng *r = &rng;
+    uint8_t *p = buf;
+
+    if (!r->seeded || r->fork_gen != fork_gen || r->output > CSPRNG_RESEED_BYTES) {
+        if (csprng_seed(r) < 0)
+            return -1;
+    }
+
+    r->output += len;
+
+    while (len > 0) {
+        size_t n;
+
+        if (r->avail == 0)
+            csprng_refill(r);
+
+        n = len < r->avail ? len : r->avail;
+
+        /* Hand out the next unused bytes and wipe them */
+        memcpy(p, r->batch + CSPRNG_BATCH - r->avail, n);
+        memset(r->batch + CSPRNG_BATCH - r->avail, 0, n);
+
+        r->avail -= n;
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "handshake.h"
+#include "utils.h"
+#include "sha1.h"
+
+#define HS_REQUEST_FORMAT           \
+    "GET %s HTTP/1.1\r\n"           \
+    "Upgrade: websocket\r\n"        \
+    "Connection: Upgrade\r\n"       \
+    "Sec-WebSocket-Version: 13\r\n" \
+    "Host: %s%s%s%s\r\n"            \
+    "%s%sSec-WebSocket-Key: "
+
+#define HS_REQUEST_ARGS \
+    path, v6 ? "[" : "", host, v6 ? "]" : "", portstr, offer, extra
+
+static pthread_mutex_t hs_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct list_head hs_cache[HS_CACHE_BUCKETS];
+static bool hs_cache_ready;
+
+static uint32_t hs_hash_str(uint32_t h, const char *s)
+{
+    /* FNV-1a, the terminating '\0' keeps "ab" + "c" apart from "a" + "bc" */
+    do {
+        h ^= (uint8_t)*s;
+        h *= 16777619;
+    } while (*s++);
+
+    return h;
+}
+
+static uint32_t hs_hash(const char *host, int port, const char *path,
+    const char *extra, const char *offer)
+{
+    uint32_t h = 2166136261u;
+
+    h = hs_hash_str(h, host);
+    h = hs_hash_str(h, path);
+    h = hs_hash_str(h, extra);
+    h = hs_hash_str(h, offer);
+
+    return h ^ port;
+}
+
+static bool hs_match(struct hs_template *t, uint32_t hash, const char *host, int port,
+    const char *path, const char *extra, const char *offer)
+{
+    return t->hash == hash && t->port == port && !strcmp(t->host, host) &&
+        !strcmp(t->path, path) && !strcmp(t->extra, extra) && !strcmp(t->offer, offer);
+}
+
+static struct hs_template *hs_render(const char *host, int port, const char *path,
+    const char *extra, const char *offer)
+{
+    size_t hostlen = strlen(host) + 1;
+    size_t pathlen = strlen(path) + 1;
+    size_t extralen = strlen(extra) + 1;
+    size_t offerlen = strlen(offer) + 1;
+    bool v6 = strchr(host, ':');
+    struct hs_template *t;
+    char portstr[8] = "";
+    char *p;
+    int len;
+
+    if (port != 80)
+        sprintf(portstr, ":%d", port);
+
+    len = snprintf(NULL, 0, HS_REQUEST_FORMAT, HS_REQUEST_ARGS);
+
+    t = calloc(1, sizeof(struct hs_template) + hostlen + pathlen + extralen + offerlen + len + 1);
+    if (!t)
+        return NULL;
+
+    p = (char *)(t + 1);
+
+    t->host = memcpy(p, host, hostlen);
+    p += hostlen;
+    t->path = memcpy(p, path, pathlen);
+    p += pathlen;
+    t->extra = memcpy(p, extra, extralen);
+    p += extralen;
+    t->offer = memcpy(p, offer, offerlen);
+    p += offerlen;
+
+    t->data = p;
+    t->len = sprintf(t->data, HS_REQUEST_FORMAT, HS_REQUEST_ARGS);
+
+    t->port = port;
+    t->refs = 1;
+
+    return t;
+}
+
+struct hs_template *hs_template_get(const char *host, int port, const char *path,
+    const char *extra, const char *offer)
+{
+    uint32_t hash = hs_hash(host, port, path, extra, offer);
+    struct list_head *head, *p, *n;
+    struct hs_template *t;
+    int i;
+
+    pthread_mutex_lock(&hs_lock);
+
+    if (!hs_cache_ready) {
+        for (i = 0; i < HS_CACHE_BUCKETS; i++)
+            INIT_LIST_HEAD(&hs_cache[i]);
+        hs_cache_ready = true;
+    }
+
+    head = &hs_cache[hash % HS_CACHE_BUCKETS];
+
+    list_for_each_safe(p, n, head) {
+        t = list_entry(p, struct hs_template, list);
+        if (hs_match(t, hash, host, port, path, extra, offer)) {
+            t->refs++;
+            goto out;
+        }
+    }
+
+    t = hs_render(host, port, path, extra, offer);
+    if (t) {
+        t->hash = hash;
+        list_add(&t->list, head);
+    }
+
+out:
+    pthread_mutex_unlock(&hs_lock);
+    return t;
+}
+
+void hs_template_put(struct hs_template *t)
+{
+    if (!t)
+        return;
+
+    pthread_mutex_lock(&hs_lock);
+
+    if (--t->refs == 0) {
+        list_del_init(&t->list);
+        free(t);
+    }
+
+    pthread_mutex_unlock(&hs_lock);
+}
+
+void hs_new_key(char key[HS_KEY_LEN], char accept[HS_ACCEPT_LEN])
+{
+    static const char *magic = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    struct sha1_ctx ctx;
+    uint8_t nonce[16];
+    uint8_t sha[20];
+
+    get_nonce(nonce, sizeof(nonce));
+    b64_encode_exact(nonce, sizeof(nonce), key);
+
+    sha1_init(&ctx);
+    sha1_update(&ctx, key, HS_KEY_LEN);
+    sha1_update(&ctx, magic, strlen(magic));
+    sha1_final(&ctx, sha);
+
+    b64_encode_exact(sha, sizeof(sha), accept);
+}
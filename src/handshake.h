@@ -0,0 +1,63 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _HANDSHAKE_H
+#define _HANDSHAKE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "list.h"
+
+#define HS_KEY_LEN          24  /* Base64 of a 16 byte nonce */
+#define HS_ACCEPT_LEN       28  /* Base64 of a SHA-1 */
+#define HS_CACHE_BUCKETS    64
+
+/*
+ * The upgrade request up to the Sec-WebSocket-Key value, rendered once
+ * and shared by all clients with the same target, extra headers and
+ * extension offer. A request is the template, the key and "\r\n\r\n".
+ */
+struct hs_template {
+    struct list_head list;
+    uint32_t hash;
+    int refs;
+    int port;
+    const char *host;       /* Copies of what it was rendered from */
+    const char *path;
+    const char *extra;
+    const char *offer;
+    size_t len;
+    char *data;
+};
+
+/* Return the template for these parameters, rendering it on first use. NULL if out of memory */
+struct hs_template *hs_template_get(const char *host, int port, const char *path,
+    const char *extra, const char *offer);
+void hs_template_put(struct hs_template *t);
+
+/* A fresh Sec-WebSocket-Key and the Sec-WebSocket-Accept the server must answer with */
+void hs_new_key(char key[HS_KEY_LEN], char accept[HS_ACCEPT_LEN]);
+
+#endif
@@ -0,0 +1,128 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "http.h"
+
+static inline bool is_ows(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+/* "HTTP/1.1 101 Switching Protocols" */
+static int http_parse_status(struct http_parser *hp, const char *line, size_t len)
+{
+    int i;
+
+    if (len < 12 || memcmp(line, "HTTP/1.1 ", 9))
+        return -1;
+
+    if (len > 12 && line[12] != ' ')
+        return -1;
+
+    for (i = 9; i < 12; i++) {
+        if (line[i] < '0' || line[i] > '9')
+            return -1;
+        hp->status = hp->status * 10 + line[i] - '0';
+    }
+
+    return 0;
+}
+
+static int http_parse_header(struct http_parser *hp, char *data, int start, int end)
+{
+    char *colon;
+    int value;
+
+    /* Obsolete line folding is not accepted, RFC 7230 section 3.2.4 */
+    if (is_ows(data[start]))
+        return -1;
+
+    colon = memchr(data + start, ':', end - start);
+    if (!colon || colon == data + start || is_ows(colon[-1]))
+        return -1;
+
+    if (hp->nheaders == HTTP_MAX_HEADERS)
+        return -1;
+
+    *colon = '\0';
+
+    value = colon + 1 - data;
+    while (value < end && is_ows(data[value]))
+        value++;
+
+    while (end > value && is_ows(data[end - 1]))
+        end--;
+    data[end] = '\0';
+
+    hp->headers[hp->nheaders].name = start;
+    hp->headers[hp->nheaders].value = value;
+    hp->nheaders++;
+
+    return 0;
+}
+
+int http_parse(struct http_parser *hp, char *data, size_t len)
+{
+    if (hp->state == HTTP_STATE_DONE)
+        return 1;
+
+    if (len > HTTP_MAX_SIZE)
+        len = HTTP_MAX_SIZE;
+
+    while (hp->pos < len) {
+        char *nl = memchr(data + hp->pos, '\n', len - hp->pos);
+        int start = hp->line;
+        int end;
+
+        if (!nl) {
+            hp->pos = len;
+            break;
+        }
+
+        end = nl - data;
+        hp->pos = end + 1;
+        hp->line = hp->pos;
+
+        /* A bare LF ends a line too */
+        if (end > start && data[end - 1] == '\r')
+            end--;
+        data[end] = '\0';
+
+        if (hp->state == HTTP_STATE_STATUS) {
+            if (http_parse_status(hp, data + start, end - start) < 0)
+                return -1;
+            hp->state = HTTP_STATE_HEADERS;
+        } else if (end == start) {
+            hp->state = HTTP_STATE_DONE;
+            return 1;
+        } else if (http_parse_header(hp, data, start, end) < 0) {
+            return -1;
+        }
+    }
+
+    return hp->pos < HTTP_MAX_SIZE ? 0 : -1;
+}
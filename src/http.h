@@ -0,0 +1,67 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _HTTP_H
+#define _HTTP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HTTP_MAX_HEADERS    32
+#define HTTP_MAX_SIZE       8192    /* Status line and headers */
+
+enum {
+    HTTP_STATE_STATUS,
+    HTTP_STATE_HEADERS,
+    HTTP_STATE_DONE
+};
+
+/*
+ * Resumable parser of an HTTP/1.1 response head. It scans only the bytes
+ * that arrived since the previous call and parses in place: the colon and
+ * the end of each line are overwritten with '\0', the names and values are
+ * kept as offsets into the data, which stay valid if the buffer moves.
+ * A zeroed struct is ready to parse.
+ */
+struct http_parser {
+    uint16_t pos;       /* Bytes scanned, the length of the head once done */
+    uint16_t line;      /* Start of the line being scanned */
+    uint8_t state;
+    uint8_t nheaders;
+    uint16_t status;
+    struct {
+        uint16_t name;
+        uint16_t value;
+    } headers[HTTP_MAX_HEADERS];
+};
+
+/*
+ *  http_parse - continue parsing the response head at the start of @data
+ *
+ *  Return 1 once the head is complete, 0 if more data is needed or -1 if
+ *  it's malformed or exceeds HTTP_MAX_SIZE or HTTP_MAX_HEADERS.
+ */
+int http_parse(struct http_parser *hp, char *data, size_t len);
+
+#endif
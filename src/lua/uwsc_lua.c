@@ -187,7 +187,7 @@ static int __uwsc_lua_send(lua_State *L, int op)
     size_t len;
     const void *data = luaL_checklstring(L, 2, &len);
 
-    cl->cli.send(&cl->cli, data, len,  op);
+    uwsc_send(&cl->cli, data, len,  op);
 
     return 0;
 }
@@ -214,8 +214,8 @@ static int uwsc_lua_gc(lua_State *L)
     struct uwsc_client_lua *cl = luaL_checkudata(L, 1, UWSC_MT);
 
     if (cl->connected) {
-        cl->cli.send_close(&cl->cli, UWSC_CLOSE_STATUS_NORMAL, "");
-        cl->cli.free(&cl->cli);
+        uwsc_send_close(&cl->cli, UWSC_CLOSE_STATUS_NORMAL, "");
+        uwsc_free(&cl->cli);
         cl->connected = false;
     }
 
@@ -0,0 +1,140 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MASK_X86
+#endif
+
+#include "mask.h"
+
+/*
+ * Each kernel masks as many whole blocks as it can and returns the number
+ * of bytes it handled. The key is replicated so a block always starts on
+ * key byte 0.
+ */
+typedef size_t (*mask_kernel_t)(uint8_t *dst, const uint8_t *src, size_t len, uint32_t key);
+
+static size_t mask_u64(uint8_t *dst, const uint8_t *src, size_t len, uint32_t key)
+{
+    uint64_t k = ((uint64_t)key << 32) | key;
+    size_t i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        uint64_t v;
+
+        memcpy(&v, src + i, 8);
+        v ^= k;
+        memcpy(dst + i, &v, 8);
+    }
+
+    return i;
+}
+
+#ifdef MASK_X86
+#ifdef __SSE2__
+static size_t mask_sse2(uint8_t *dst, const uint8_t *src, size_t len, uint32_t key)
+{
+    __m128i k = _mm_set1_epi32(key);
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(v, k));
+    }
+
+    return i + mask_u64(dst + i, src + i, len - i, key);
+}
+#endif
+
+__attribute__((target("avx2")))
+static size_t mask_avx2(uint8_t *dst, const uint8_t *src, size_t len, uint32_t key)
+{
+    __m256i k = _mm256_set1_epi32(key);
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(v, k));
+    }
+
+    return i + mask_u64(dst + i, src + i, len - i, key);
+}
+#endif
+
+static mask_kernel_t mask_kernel_select(void)
+{
+#ifdef MASK_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return mask_avx2;
+#ifdef __SSE2__
+    return mask_sse2;
+#endif
+#endif
+    return mask_u64;
+}
+
+/* Selected on first use */
+static mask_kernel_t mask_kernel;
+
+void websocket_mask(void *dst, const void *src, size_t len, const uint8_t key[4], size_t pos)
+{
+    const uint8_t *s = src;
+    uint8_t *d = dst;
+    uint8_t k[4];
+    uint32_t kw;
+    size_t n;
+    int i;
+
+    if (!mask_kernel)
+        mask_kernel = mask_kernel_select();
+
+    for (i = 0; i < 4; i++)
+        k[i] = key[(pos + i) & 3];
+
+    /* Unaligned head: go byte by byte until the output is 8-byte aligned */
+    for (i = 0; len > 0 && ((uintptr_t)d & 7); i++, len--)
+        *d++ = *s++ ^ k[i & 3];
+
+    /* Rotate the key so that it starts at the current payload offset */
+    if (i & 3) {
+        uint8_t t[4];
+        int j;
+
+        for (j = 0; j < 4; j++)
+            t[j] = k[(i + j) & 3];
+        memcpy(k, t, 4);
+    }
+
+    memcpy(&kw, k, 4);
+
+    n = len < 8 ? 0 : mask_kernel(d, s, len, kw);
+
+    /* Tail: whole blocks are multiples of 4 so the key phase is unchanged */
+    for (i = 0; n < len; n++, i++)
+        d[n] = s[n] ^ k[i & 3];
+}
@@ -0,0 +1,506 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#ifdef DEFLATE_SUPPORT
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "log.h"
+#include "uwsc.h"
+#include "pmdeflate.h"
+
+#define PMD_CHUNK           16384
+
+/*
+ * zlib allocates a handful of fixed-size blocks per stream. With shared_pool
+ * the blocks freed by one connection are kept on per-size free lists and
+ * handed to the next connection, instead of going back to the heap.
+ */
+#define PMD_POOL_CLASSES    8
+#define PMD_POOL_DEPTH      64
+
+struct pool_block {
+    size_t size;
+    struct pool_block *next;
+} __attribute__((aligned(16)));
+
+struct pool_class {
+    size_t size;
+    int count;
+    struct pool_block *free;
+};
+
+static struct pool_class pool[PMD_POOL_CLASSES];
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static voidpf pool_alloc(voidpf opaque, uInt items, uInt size)
+{
+    size_t len = (size_t)items * size;
+    struct pool_block *b = NULL;
+    int i;
+
+    pthread_mutex_lock(&pool_lock);
+    for (i = 0; i < PMD_POOL_CLASSES; i++) {
+        if (pool[i].size == len && pool[i].free) {
+            b = pool[i].free;
+            pool[i].free = b->next;
+            pool[i].count--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (!b) {
+        b = malloc(sizeof(struct pool_block) + len);
+        if (!b)
+            return Z_NULL;
+        b->size = len;
+    }
+
+    return b + 1;
+}
+
+static void pool_free(voidpf opaque, voidpf ptr)
+{
+    struct pool_block *b = (struct pool_block *)ptr - 1;
+    struct pool_class *c = NULL;
+    int i;
+
+    pthread_mutex_lock(&pool_lock);
+    for (i = 0; i < PMD_POOL_CLASSES; i++) {
+        if (pool[i].size == b->size) {
+            c = &pool[i];
+            break;
+        }
+
+        if (!c && pool[i].size == 0)
+            c = &pool[i];
+    }
+
+    if (c && c->count < PMD_POOL_DEPTH) {
+        c->size = b->size;
+        b->next = c->free;
+        c->free = b;
+        c->count++;
+        b = NULL;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    free(b);
+}
+
+static void pmd_render_offer(struct pmdeflate *pmd)
+{
+    char *p = pmd->offer;
+    char *end = pmd->offer + sizeof(pmd->offer);
+
+    p += snprintf(p, end - p, "Sec-WebSocket-Extensions: permessage-deflate");
+
+    if (pmd->client_max_window_bits)
+        p += snprintf(p, end - p, "; client_max_window_bits=%d", pmd->client_max_window_bits);
+
+    if (pmd->server_max_window_bits)
+        p += snprintf(p, end - p, "; server_max_window_bits=%d", pmd->server_max_window_bits);
+
+    if (pmd->client_no_context_takeover)
+        p += snprintf(p, end - p, "; client_no_context_takeover");
+
+    if (pmd->server_no_context_takeover)
+        p += snprintf(p, end - p, "; server_no_context_takeover");
+
+    snprintf(p, end - p, "\r\n");
+}
+
+struct pmdeflate *pmd_new(const struct uwsc_deflate_options *opts)
+{
+    struct pmdeflate *pmd;
+
+    if (opts->level < 0 || opts->level > 9)
+        return NULL;
+
+    if (opts->client_max_window_bits && (opts->client_max_window_bits < 9 ||
+        opts->client_max_window_bits > 15))
+        return NULL;
+
+    if (opts->server_max_window_bits && (opts->server_max_window_bits < 8 ||
+        opts->server_max_window_bits > 15))
+        return NULL;
+
+    pmd = calloc(1, sizeof(struct pmdeflate));
+    if (!pmd)
+        return NULL;
+
+    pmd->level = opts->level ? opts->level : Z_DEFAULT_COMPRESSION;
+    pmd->shared_pool = opts->shared_pool;
+    pmd->client_max_window_bits = opts->client_max_window_bits;
+    pmd->server_max_window_bits = opts->server_max_window_bits;
+    pmd->client_no_context_takeover = opts->client_no_context_takeover;
+    pmd->server_no_context_takeover = opts->server_no_context_takeover;
+
+    pmd_render_offer(pmd);
+
+    return pmd;
+}
+
+void pmd_reset(struct pmdeflate *pmd)
+{
+    if (pmd->tx_ready)
+        deflateEnd(&pmd->tx);
+
+    if (pmd->rx_ready)
+        inflateEnd(&pmd->rx);
+
+    pmd->tx_ready = false;
+    pmd->rx_ready = false;
+    pmd->negotiated = false;
+
+    buffer_free(&pmd->ob);
+    buffer_free(&pmd->ib);
+}
+
+void pmd_free(struct pmdeflate *pmd)
+{
+    if (!pmd)
+        return;
+
+    pmd_reset(pmd);
+    free(pmd);
+}
+
+static char *trim(char *s)
+{
+    char *e;
+
+    while (*s == ' ' || *s == '\t')
+        s++;
+
+    e = s + strlen(s);
+    while (e > s && (e[-1] == ' ' || e[-1] == '\t'))
+        *--e = '\0';
+
+    return s;
+}
+
+static int parse_window_bits(const char *v, int min)
+{
+    int bits;
+
+    if (!v)
+        return -1;
+
+    bits = atoi(v);
+    if (bits < min || bits > 15)
+        return -1;
+
+    return bits;
+}
+
+/* Parameters of the response, each may appear only once */
+enum {
+    PMD_PARAM_SERVER_NCT    = 1 << 0,
+    PMD_PARAM_CLIENT_NCT    = 1 << 1,
+    PMD_PARAM_SERVER_BITS   = 1 << 2,
+    PMD_PARAM_CLIENT_BITS   = 1 << 3
+};
+
+int pmd_accept(struct pmdeflate *pmd, const char *value)
+{
+    char buf[256];
+    char *tok, *save;
+    int seen = 0;
+
+    if (strlen(value) >= sizeof(buf))
+        return -1;
+
+    strcpy(buf, value);
+
+    /* Only one extension was offered */
+    if (strchr(buf, ','))
+        return -1;
+
+    tok = strtok_r(buf, ";", &save);
+    if (!tok || strcmp(trim(tok), "permessage-deflate"))
+        return -1;
+
+    pmd->client_bits = pmd->client_max_window_bits ? pmd->client_max_window_bits : 15;
+    pmd->server_bits = pmd->server_max_window_bits ? pmd->server_max_window_bits : 15;
+    pmd->client_nct = pmd->client_no_context_takeover;
+    pmd->server_nct = false;
+
+    while ((tok = strtok_r(NULL, ";", &save))) {
+        char *name = trim(tok);
+        char *v = strchr(name, '=');
+        int param;
+
+        if (v) {
+            *v++ = '\0';
+            name = trim(name);
+            v = trim(v);
+            if (*v == '"') {
+                v++;
+                v[strcspn(v, "\"")] = '\0';
+            }
+        }
+
+        if (!strcmp(name, "server_no_context_takeover")) {
+            param = PMD_PARAM_SERVER_NCT;
+        } else if (!strcmp(name, "client_no_context_takeover")) {
+            param = PMD_PARAM_CLIENT_NCT;
+        } else if (!strcmp(name, "server_max_window_bits")) {
+            param = PMD_PARAM_SERVER_BITS;
+        } else if (!strcmp(name, "client_max_window_bits")) {
+            param = PMD_PARAM_CLIENT_BITS;
+        } else {
+            log_err("Unknown permessage-deflate parameter: %s\n", name);
+            return -1;
+        }
+
+        /* RFC 7692, section 7.1 */
+        if (seen & param) {
+            log_err("Duplicate permessage-deflate parameter: %s\n", name);
+            return -1;
+        }
+        seen |= param;
+
+        if (param == PMD_PARAM_SERVER_NCT) {
+            pmd->server_nct = true;
+        } else if (param == PMD_PARAM_CLIENT_NCT) {
+            pmd->client_nct = true;
+        } else if (param == PMD_PARAM_SERVER_BITS) {
+            int bits = parse_window_bits(v, 8);
+            if (bits < 0 || (pmd->server_max_window_bits && bits > pmd->server_max_window_bits))
+                return -1;
+            pmd->server_bits = bits;
+        } else {
+            /* zlib can't produce a raw deflate stream with a 256 byte window */
+            int bits = parse_window_bits(v, 9);
+
+            /* Only allowed in answer to our offer, and no larger (RFC 7692, section 7.1.2.2) */
+            if (bits < 0 || !pmd->client_max_window_bits || bits > pmd->client_max_window_bits)
+                return -1;
+            pmd->client_bits = bits;
+        }
+    }
+
+    /*
+     * A server that accepts our server_no_context_takeover must echo it
+     * (RFC 7692, section 7.1.1.1), otherwise it may refer back to earlier
+     * messages while we reset the inflater after each one.
+     */
+    if (pmd->server_no_context_takeover && !pmd->server_nct) {
+        log_err("permessage-deflate response lacks server_no_context_takeover\n");
+        return -1;
+    }
+
+    pmd->negotiated = true;
+
+    return 0;
+}
+
+static void pmd_set_allocator(struct pmdeflate *pmd, z_stream *zs)
+{
+    memset(zs, 0, sizeof(z_stream));
+
+    if (pmd->shared_pool) {
+        zs->zalloc = pool_alloc;
+        zs->zfree = pool_free;
+    }
+}
+
+static int pmd_deflate(z_stream *zs, struct buffer *out, int flush)
+{
+    int ret;
+
+    do {
+        uint8_t *p = buffer_put(out, PMD_CHUNK);
+        if (!p)
+            return -1;
+
+        zs->next_out = p;
+        zs->avail_out = PMD_CHUNK;
+
+        ret = deflate(zs, flush);
+
+        buffer_truncate(out, buffer_length(out) - zs->avail_out);
+
+        if (ret == Z_STREAM_ERROR)
+            return -1;
+    } while (zs->avail_out == 0);
+
+    return 0;
+}
+
+int pmd_compress(struct pmdeflate *pmd, const struct iovec *iov, int iovcnt, bool fin)
+{
+    static const uint8_t tail[4] = {0x00, 0x00, 0xff, 0xff};
+    struct buffer *ob = &pmd->ob;
+    z_stream *zs = &pmd->tx;
+    int i;
+
+    if (!pmd->tx_ready) {
+        pmd_set_allocator(pmd, zs);
+        if (deflateInit2(zs, pmd->level, Z_DEFLATED, -pmd->client_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            log_err("deflateInit2 failed\n");
+            return -1;
+        }
+        pmd->tx_ready = true;
+    }
+
+    buffer_pull(ob, NULL, buffer_length(ob));
+
+    for (i = 0; i < iovcnt; i++) {
+        const uint8_t *p = iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+
+        while (len > 0) {
+            size_t n = len > UINT_MAX ? UINT_MAX : len;
+
+            zs->next_in = (Bytef *)p;
+            zs->avail_in = n;
+
+            if (pmd_deflate(zs, ob, Z_NO_FLUSH) < 0)
+                goto err;
+
+            p += n;
+            len -= n;
+        }
+    }
+
+    if (pmd_deflate(zs, ob, Z_SYNC_FLUSH) < 0)
+        goto err;
+
+    if (fin) {
+        size_t len = buffer_length(ob);
+
+        if (len >= 4 && !memcmp((uint8_t *)buffer_data(ob) + len - 4, tail, 4))
+            buffer_truncate(ob, len - 4);
+
+        if (pmd->client_nct)
+            deflateReset(zs);
+    }
+
+    return 0;
+
+err:
+    pmd_discard(pmd);
+    return -1;
+}
+
+void pmd_discard(struct pmdeflate *pmd)
+{
+    buffer_pull(&pmd->ob, NULL, buffer_length(&pmd->ob));
+
+    if (pmd->tx_ready)
+        deflateReset(&pmd->tx);
+}
+
+static int pmd_inflate(z_stream *zs, const void *data, size_t len, pmd_sink_t sink, void *arg)
+{
+    const uint8_t *p = data;
+    uint8_t out[PMD_CHUNK];
+
+    while (len > 0) {
+        size_t n = len > UINT_MAX ? UINT_MAX : len;
+
+        zs->next_in = (Bytef *)p;
+        zs->avail_in = n;
+
+        do {
+            size_t produced;
+            bool stalled;
+            int ret;
+
+            zs->next_out = out;
+            zs->avail_out = sizeof(out);
+
+            ret = inflate(zs, Z_SYNC_FLUSH);
+            if (ret == Z_STREAM_END) {
+                /* The server ended the stream with a final block */
+                inflateReset(zs);
+            } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                log_err("inflate failed: %s\n", zs->msg ? zs->msg : "");
+                return -1;
+            }
+
+            stalled = ret == Z_BUF_ERROR;
+
+            produced = sizeof(out) - zs->avail_out;
+            if (produced > 0) {
+                ret = sink(arg, out, produced);
+                if (ret < 0)
+                    return ret;
+            }
+
+            if (stalled && produced == 0)
+                break;
+        } while (zs->avail_in > 0 || zs->avail_out == 0);
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+int pmd_decompress(struct pmdeflate *pmd, const void *data, size_t len, bool fin,
+    pmd_sink_t sink, void *arg)
+{
+    static const uint8_t tail[4] = {0x00, 0x00, 0xff, 0xff};
+    z_stream *zs = &pmd->rx;
+    int ret;
+
+    if (!pmd->rx_ready) {
+        int bits = pmd->server_bits < 9 ? 9 : pmd->server_bits;
+
+        pmd_set_allocator(pmd, zs);
+        if (inflateInit2(zs, -bits) != Z_OK) {
+            log_err("inflateInit2 failed\n");
+            return -1;
+        }
+        pmd->rx_ready = true;
+    }
+
+    ret = pmd_inflate(zs, data, len, sink, arg);
+    if (ret < 0)
+        return ret;
+
+    if (fin) {
+        ret = pmd_inflate(zs, tail, 4, sink, arg);
+        if (ret < 0)
+            return ret;
+
+        if (pmd->server_nct)
+            inflateReset(zs);
+    }
+
+    return 0;
+}
+
+#endif
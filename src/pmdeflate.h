@@ -0,0 +1,93 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PMDEFLATE_H
+#define _PMDEFLATE_H
+
+#include <zlib.h>
+#include <sys/uio.h>
+
+#include "buffer.h"
+
+/* permessage-deflate, RFC 7692 */
+
+struct uwsc_deflate_options;
+
+struct pmdeflate {
+    z_stream tx;
+    z_stream rx;
+    bool tx_ready;
+    bool rx_ready;
+    bool negotiated;
+
+    int level;
+    bool shared_pool;
+
+    /* What we offer */
+    int client_max_window_bits;
+    int server_max_window_bits;
+    bool client_no_context_takeover;
+    bool server_no_context_takeover;
+    char offer[192];    /* The Sec-WebSocket-Extensions request header */
+
+    /* What the server accepted */
+    int client_bits;
+    int server_bits;
+    bool client_nct;
+    bool server_nct;
+
+    struct buffer ob;   /* Compressed payload of the frame being sent */
+    struct buffer ib;   /* Inflated message for onmessage */
+};
+
+/* Receive inflated data. A negative return aborts and is passed back by pmd_decompress */
+typedef int (*pmd_sink_t)(void *arg, void *data, size_t len);
+
+struct pmdeflate *pmd_new(const struct uwsc_deflate_options *opts);
+void pmd_free(struct pmdeflate *pmd);
+
+/* Back to the offer, for a new connection */
+void pmd_reset(struct pmdeflate *pmd);
+
+/* Parse the Sec-WebSocket-Extensions response header */
+int pmd_accept(struct pmdeflate *pmd, const char *value);
+
+/*
+ * Compress a frame payload into pmd->ob. The trailing 0x00 0x00 0xff 0xff
+ * of the last frame of a message is stripped as the RFC requires.
+ */
+int pmd_compress(struct pmdeflate *pmd, const struct iovec *iov, int iovcnt, bool fin);
+
+/*
+ * Drop a compressed payload that won't be sent. The compressor starts over
+ * without history, so it never refers to data the server didn't get. Every
+ * frame ends on a flushed block, so the server's stream stays valid.
+ */
+void pmd_discard(struct pmdeflate *pmd);
+
+/* Inflate a piece of a compressed message, @fin at the end of the message */
+int pmd_decompress(struct pmdeflate *pmd, const void *data, size_t len, bool fin,
+    pmd_sink_t sink, void *arg);
+
+#endif
@@ -0,0 +1,312 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "pool.h"
+
+/* Slots are kept 16 byte aligned, like what malloc returns */
+#define POOL_SLOT_SIZE  ((sizeof(struct uwsc_client) + 15) & ~(size_t)15)
+
+struct pool_slot {
+    struct pool_slot *next;
+};
+
+struct pool_slab {
+    struct pool_slab *next;
+} __attribute__((aligned(16)));
+
+/* Lives in the cached block itself */
+struct pool_buf {
+    struct pool_buf *next;
+};
+
+struct pool_class {
+    size_t count;
+    struct pool_buf *free;
+};
+
+struct uwsc_pool {
+    struct ev_loop *loop;
+    int slab_clients;
+    int buffer_depth;
+    bool dead;                  /* uwsc_pool_free was called with clients left */
+
+    struct pool_slab *slabs;
+    struct pool_slot *free_clients;
+    size_t nslabs;
+    size_t nclients;
+    size_t nfree;
+
+    struct pool_class classes[UWSC_POOL_CLASSES];
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t drops;
+};
+
+static inline size_t pool_class_size(int i)
+{
+    return (size_t)POOL_BUF_MIN << i;
+}
+
+static void pool_destroy(struct uwsc_pool *pool)
+{
+    struct pool_slab *s = pool->slabs;
+    int i;
+
+    while (s) {
+        struct pool_slab *next = s->next;
+        free(s);
+        s = next;
+    }
+
+    for (i = 0; i < UWSC_POOL_CLASSES; i++) {
+        struct pool_buf *b = pool->classes[i].free;
+
+        while (b) {
+            struct pool_buf *next = b->next;
+            free(b);
+            b = next;
+        }
+    }
+
+    free(pool);
+}
+
+static int pool_grow(struct uwsc_pool *pool)
+{
+    struct pool_slab *s;
+    uint8_t *p;
+    int i;
+
+    s = malloc(sizeof(struct pool_slab) + POOL_SLOT_SIZE * pool->slab_clients);
+    if (!s)
+        return -1;
+
+    s->next = pool->slabs;
+    pool->slabs = s;
+    pool->nslabs++;
+
+    /* Push in reverse, so that slots are handed out in address order */
+    p = (uint8_t *)(s + 1) + POOL_SLOT_SIZE * pool->slab_clients;
+    for (i = 0; i < pool->slab_clients; i++) {
+        struct pool_slot *slot;
+
+        p -= POOL_SLOT_SIZE;
+        slot = (struct pool_slot *)p;
+        slot->next = pool->free_clients;
+        pool->free_clients = slot;
+    }
+
+    pool->nfree += pool->slab_clients;
+
+    return 0;
+}
+
+struct uwsc_client *pool_client_alloc(struct uwsc_pool *pool)
+{
+    struct pool_slot *slot;
+
+    if (!pool->free_clients && pool_grow(pool) < 0)
+        return NULL;
+
+    slot = pool->free_clients;
+    pool->free_clients = slot->next;
+    pool->nfree--;
+    pool->nclients++;
+
+    return (struct uwsc_client *)slot;
+}
+
+void pool_client_free(struct uwsc_pool *pool, struct uwsc_client *cl)
+{
+    struct pool_slot *slot = (struct pool_slot *)cl;
+
+    slot->next = pool->free_clients;
+    pool->free_clients = slot;
+    pool->nfree++;
+    pool->nclients--;
+
+    if (pool->dead && pool->nclients == 0)
+        pool_destroy(pool);
+}
+
+void pool_buffer_get(struct uwsc_pool *pool, struct buffer *b, size_t len)
+{
+    struct pool_class *c;
+    struct pool_buf *pb;
+    int i, j;
+
+    if (len < POOL_BUF_MIN)
+        len = POOL_BUF_MIN;
+
+    for (i = 0; i < UWSC_POOL_CLASSES; i++) {
+        if (pool_class_size(i) >= len)
+            break;
+    }
+
+    if (i == UWSC_POOL_CLASSES)
+        return;
+
+    /* A larger block beats going to the heap */
+    for (j = i; j < UWSC_POOL_CLASSES; j++) {
+        if (pool->classes[j].free)
+            break;
+    }
+
+    if (j < UWSC_POOL_CLASSES) {
+        c = &pool->classes[j];
+        pb = c->free;
+        c->free = pb->next;
+        c->count--;
+        pool->hits++;
+        i = j;
+    } else {
+        /* Allocated at a class size, so that it can come back to the pool */
+        pb = malloc(pool_class_size(i));
+        if (!pb)
+            return;
+        pool->misses++;
+    }
+
+    /* The buffer library may grow the block with realloc or free it, like its own */
+    b->head = b->data = b->tail = (uint8_t *)pb;
+    b->end = b->head + pool_class_size(i);
+}
+
+void pool_buffer_put(struct uwsc_pool *pool, struct buffer *b)
+{
+    size_t size = buffer_size(b);
+    struct pool_class *c;
+    struct pool_buf *pb;
+    int i;
+
+    if (!size)
+        return;
+
+    /* The largest class the block can serve */
+    for (i = UWSC_POOL_CLASSES - 1; i >= 0; i--) {
+        if (pool_class_size(i) <= size)
+            break;
+    }
+
+    if (pool->dead || i < 0 || size >= pool_class_size(i) * 2 ||
+        pool->classes[i].count >= (size_t)pool->buffer_depth) {
+        pool->drops++;
+        buffer_free(b);
+        return;
+    }
+
+    c = &pool->classes[i];
+    pb = (struct pool_buf *)b->head;
+    pb->next = c->free;
+    c->free = pb;
+    c->count++;
+
+    b->head = b->data = b->tail = b->end = NULL;
+}
+
+struct uwsc_pool *uwsc_pool_new(struct ev_loop *loop, const struct uwsc_pool_options *opts)
+{
+    struct uwsc_pool *pool;
+
+    if (opts && (opts->slab_clients < 0 || opts->buffer_depth < 0)) {
+        log_err("Invalid pool options\n");
+        return NULL;
+    }
+
+    pool = calloc(1, sizeof(struct uwsc_pool));
+    if (!pool) {
+        log_err("malloc failed: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    pool->loop = loop ? loop : EV_DEFAULT;
+    pool->slab_clients = opts && opts->slab_clients ? opts->slab_clients : POOL_SLAB_CLIENTS;
+    pool->buffer_depth = opts && opts->buffer_depth ? opts->buffer_depth : POOL_BUF_DEPTH;
+
+    return pool;
+}
+
+void uwsc_pool_free(struct uwsc_pool *pool)
+{
+    if (!pool)
+        return;
+
+    /* Clients still out keep it alive, the last uwsc_delete frees it */
+    if (pool->nclients > 0) {
+        pool->dead = true;
+        return;
+    }
+
+    pool_destroy(pool);
+}
+
+void uwsc_pool_stats(const struct uwsc_pool *pool, struct uwsc_pool_stats *st)
+{
+    int i;
+
+    memset(st, 0, sizeof(struct uwsc_pool_stats));
+
+    st->slabs = pool->nslabs;
+    st->slab_bytes = pool->nslabs * (sizeof(struct pool_slab) + POOL_SLOT_SIZE * pool->slab_clients);
+    st->clients = pool->nclients;
+    st->clients_free = pool->nfree;
+    st->buffer_hits = pool->hits;
+    st->buffer_misses = pool->misses;
+    st->buffer_drops = pool->drops;
+
+    for (i = 0; i < UWSC_POOL_CLASSES; i++) {
+        st->buffers[i] = pool->classes[i].count;
+        st->buffer_bytes += pool->classes[i].count * pool_class_size(i);
+    }
+}
+
+struct uwsc_client *uwsc_pool_client_new(struct uwsc_pool *pool, const char *url,
+    int ping_interval, const char *extra_header)
+{
+    struct uwsc_client *cl;
+
+    if (pool->dead) {
+        log_err("The pool is being freed\n");
+        return NULL;
+    }
+
+    cl = pool_client_alloc(pool);
+    if (!cl) {
+        log_err("malloc failed: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    if (uwsc_init(cl, pool->loop, url, ping_interval, extra_header) < 0) {
+        pool_client_free(pool, cl);
+        return NULL;
+    }
+
+    cl->pool = pool;
+
+    return cl;
+}
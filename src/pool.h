@@ -0,0 +1,49 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _POOL_H
+#define _POOL_H
+
+#include "uwsc.h"
+
+/*
+ * Per loop pool of client structs and I/O buffer storage. Clients are cut
+ * from slabs, buffers released by a connection are kept on per size class
+ * free lists and handed to the next one. Used from the loop's thread only.
+ */
+
+#define POOL_BUF_MIN        4096
+#define POOL_SLAB_CLIENTS   64
+#define POOL_BUF_DEPTH      256
+
+struct uwsc_client *pool_client_alloc(struct uwsc_pool *pool);
+void pool_client_free(struct uwsc_pool *pool, struct uwsc_client *cl);
+
+/* Give the empty @b storage for at least @len bytes, left to the buffer library beyond the largest class */
+void pool_buffer_get(struct uwsc_pool *pool, struct buffer *b, size_t len);
+
+/* Take the storage of @b back, its content is dropped */
+void pool_buffer_put(struct uwsc_pool *pool, struct buffer *b);
+
+#endif
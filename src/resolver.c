@@ -0,0 +1,443 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "log.h"
+#include "uwsc.h"
+#include "resolver.h"
+
+/* One per loop with queries in flight, answers are handed over through its ev_async */
+struct dns_loop {
+    struct list_head node;
+    struct ev_loop *loop;
+    struct ev_async async;
+    struct list_head done;
+    int refs;
+};
+
+struct dns_entry {
+    struct dns_entry *next;     /* Hash chain */
+    struct list_head work;      /* On the work queue until a thread picks it up */
+    struct list_head waiters;   /* Queries waiting for this lookup */
+    bool pending;
+    int error;
+    int naddrs;
+    union dns_addr addrs[DNS_MAX_ADDRS];
+    double expires;
+    char host[];
+};
+
+static pthread_mutex_t dns_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dns_cond = PTHREAD_COND_INITIALIZER;
+static struct dns_entry *dns_cache[DNS_CACHE_BUCKETS];
+static struct list_head dns_work = LIST_HEAD_INIT(dns_work);
+static struct list_head dns_loops = LIST_HEAD_INIT(dns_loops);
+static int dns_threads;
+static int dns_idle;
+static int positive_ttl = DNS_POSITIVE_TTL;
+static int negative_ttl = DNS_NEGATIVE_TTL;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static const struct addrinfo dns_hints = {
+    .ai_family = AF_UNSPEC,
+    .ai_socktype = SOCK_STREAM,
+    .ai_flags = AI_ADDRCONFIG
+};
+
+static double dns_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned int dns_hash(const char *host)
+{
+    unsigned int h = 2166136261u;
+
+    while (*host)
+        h = (h ^ tolower((unsigned char)*host++)) * 16777619u;
+
+    return h % DNS_CACHE_BUCKETS;
+}
+
+static int dns_copy_addrs(union dns_addr *addrs, struct addrinfo *res)
+{
+    int n = 0;
+
+    for (; res && n < DNS_MAX_ADDRS; res = res->ai_next) {
+        if (res->ai_addrlen > sizeof(union dns_addr))
+            continue;
+        memcpy(&addrs[n++], res->ai_addr, res->ai_addrlen);
+    }
+
+    return n;
+}
+
+static void dns_fill(struct dns_query *q, int error, const union dns_addr *addrs, int naddrs)
+{
+    int i;
+
+    q->error = error;
+    q->naddrs = naddrs;
+
+    for (i = 0; i < naddrs; i++) {
+        q->addrs[i] = addrs[i];
+
+        if (addrs[i].sa.sa_family == AF_INET6)
+            q->addrs[i].sin6.sin6_port = htons(q->port);
+        else
+            q->addrs[i].sin.sin_port = htons(q->port);
+    }
+}
+
+static void dns_loop_put(struct dns_loop *dl)
+{
+    if (--dl->refs > 0)
+        return;
+
+    list_del_init(&dl->node);
+    ev_ref(dl->loop);
+    ev_async_stop(dl->loop, &dl->async);
+    free(dl);
+}
+
+static void dns_async_cb(struct ev_loop *loop, struct ev_async *w, int revents)
+{
+    struct dns_loop *dl = container_of(w, struct dns_loop, async);
+    struct dns_query *q;
+
+    pthread_mutex_lock(&dns_lock);
+
+    /* Callbacks may start or cancel queries, hold on to dl meanwhile */
+    dl->refs++;
+
+    while (!list_empty(&dl->done)) {
+        q = list_first_entry(&dl->done, struct dns_query, list);
+        list_del_init(&q->list);
+        q->dl = NULL;
+        dl->refs--;
+
+        pthread_mutex_unlock(&dns_lock);
+        q->cb(q);
+        pthread_mutex_lock(&dns_lock);
+    }
+
+    dns_loop_put(dl);
+
+    pthread_mutex_unlock(&dns_lock);
+}
+
+static struct dns_loop *dns_loop_get(struct ev_loop *loop)
+{
+    struct list_head *p, *n;
+    struct dns_loop *dl;
+
+    list_for_each_safe(p, n, &dns_loops) {
+        dl = list_entry(p, struct dns_loop, node);
+        if (dl->loop == loop) {
+            dl->refs++;
+            return dl;
+        }
+    }
+
+    dl = calloc(1, sizeof(struct dns_loop));
+    if (!dl)
+        return NULL;
+
+    dl->loop = loop;
+    dl->refs = 1;
+    INIT_LIST_HEAD(&dl->done);
+    list_add(&dl->node, &dns_loops);
+
+    ev_async_init(&dl->async, dns_async_cb);
+    ev_async_start(loop, &dl->async);
+
+    /* Pending queries keep their clients' timers running, the watcher need not keep the loop */
+    ev_unref(loop);
+
+    return dl;
+}
+
+static void *dns_worker(void *arg)
+{
+    union dns_addr addrs[DNS_MAX_ADDRS];
+    struct list_head *p, *n;
+    struct addrinfo *res;
+    struct dns_entry *e;
+    struct dns_query *q;
+    int naddrs = 0;
+    int ttl;
+    int ret;
+
+    pthread_mutex_lock(&dns_lock);
+
+    while (1) {
+        while (list_empty(&dns_work)) {
+            dns_idle++;
+            pthread_cond_wait(&dns_cond, &dns_lock);
+            dns_idle--;
+        }
+
+        e = list_first_entry(&dns_work, struct dns_entry, work);
+        list_del_init(&e->work);
+
+        pthread_mutex_unlock(&dns_lock);
+
+        ret = getaddrinfo(e->host, NULL, &dns_hints, &res);
+        if (!ret) {
+            naddrs = dns_copy_addrs(addrs, res);
+            freeaddrinfo(res);
+            if (!naddrs)
+                ret = EAI_NODATA;
+        }
+
+        pthread_mutex_lock(&dns_lock);
+
+        e->pending = false;
+        e->error = ret;
+        e->naddrs = ret ? 0 : naddrs;
+        memcpy(e->addrs, addrs, sizeof(union dns_addr) * e->naddrs);
+
+        /* Only authoritative failures are worth remembering */
+        if (!ret)
+            ttl = positive_ttl;
+        else if (ret == EAI_NONAME || ret == EAI_NODATA)
+            ttl = negative_ttl;
+        else
+            ttl = 0;
+
+        e->expires = dns_now() + ttl;
+
+        list_for_each_safe(p, n, &e->waiters) {
+            q = list_entry(p, struct dns_query, list);
+            dns_fill(q, e->error, e->addrs, e->naddrs);
+            list_move_tail(&q->list, &q->dl->done);
+            ev_async_send(q->dl->loop, &q->dl->async);
+        }
+    }
+
+    return NULL;
+}
+
+static int dns_spawn_worker(void)
+{
+    pthread_attr_t attr;
+    pthread_t tid;
+    int ret;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    ret = pthread_create(&tid, &attr, dns_worker, NULL);
+    pthread_attr_destroy(&attr);
+
+    if (ret) {
+        log_err("pthread_create failed: %s\n", strerror(ret));
+        return -1;
+    }
+
+    dns_threads++;
+
+    return 0;
+}
+
+/* Hold the lock across fork(), so that the child gets a consistent state */
+static void dns_atfork_prepare(void)
+{
+    pthread_mutex_lock(&dns_lock);
+}
+
+static void dns_atfork_parent(void)
+{
+    pthread_mutex_unlock(&dns_lock);
+}
+
+/* The workers don't survive fork(), lookups they had taken go back on the queue */
+static void dns_atfork_child(void)
+{
+    struct dns_entry *e;
+    int i;
+
+    for (i = 0; i < DNS_CACHE_BUCKETS; i++) {
+        for (e = dns_cache[i]; e; e = e->next) {
+            if (e->pending && list_empty(&e->work))
+                list_add_tail(&e->work, &dns_work);
+        }
+    }
+
+    dns_threads = 0;
+    dns_idle = 0;
+    pthread_cond_init(&dns_cond, NULL);
+
+    pthread_mutex_unlock(&dns_lock);
+}
+
+static void dns_atfork_register(void)
+{
+    pthread_atfork(dns_atfork_prepare, dns_atfork_parent, dns_atfork_child);
+}
+
+/* Return the cached entry of @host, dropping expired entries of its bucket on the way */
+static struct dns_entry *dns_lookup(unsigned int bucket, const char *host, double now)
+{
+    struct dns_entry **pe = &dns_cache[bucket];
+    struct dns_entry *e;
+
+    while ((e = *pe)) {
+        if (!e->pending && e->expires <= now) {
+            *pe = e->next;
+            free(e);
+            continue;
+        }
+
+        if (!strcasecmp(e->host, host))
+            return e;
+
+        pe = &e->next;
+    }
+
+    return NULL;
+}
+
+int dns_resolve(struct ev_loop *loop, struct dns_query *q, const char *host, int port,
+    void (*cb)(struct dns_query *q))
+{
+    struct addrinfo hints = dns_hints;
+    unsigned int bucket;
+    struct addrinfo *res;
+    struct dns_entry *e;
+    struct dns_loop *dl;
+    bool queued = false;
+
+    pthread_once(&atfork_once, dns_atfork_register);
+
+    INIT_LIST_HEAD(&q->list);
+    q->dl = NULL;
+    q->cb = cb;
+    q->port = port;
+
+    /* Numeric hosts never hit the network */
+    hints.ai_flags |= AI_NUMERICHOST;
+    if (!getaddrinfo(host, NULL, &hints, &res)) {
+        union dns_addr addrs[DNS_MAX_ADDRS];
+
+        dns_fill(q, 0, addrs, dns_copy_addrs(addrs, res));
+        freeaddrinfo(res);
+        return 0;
+    }
+
+    bucket = dns_hash(host);
+
+    pthread_mutex_lock(&dns_lock);
+
+    e = dns_lookup(bucket, host, dns_now());
+    if (e && !e->pending) {
+        dns_fill(q, e->error, e->addrs, e->naddrs);
+        pthread_mutex_unlock(&dns_lock);
+        return 0;
+    }
+
+    dl = dns_loop_get(loop);
+    if (!dl)
+        goto err;
+
+    if (!e) {
+        e = calloc(1, sizeof(struct dns_entry) + strlen(host) + 1);
+        if (!e) {
+            dns_loop_put(dl);
+            goto err;
+        }
+
+        strcpy(e->host, host);
+        e->pending = true;
+        INIT_LIST_HEAD(&e->waiters);
+        list_add_tail(&e->work, &dns_work);
+
+        e->next = dns_cache[bucket];
+        dns_cache[bucket] = e;
+        queued = true;
+    }
+
+    /* A child of fork() has lookups queued but no workers yet */
+    if (queued || !dns_threads) {
+        if (dns_idle > 0)
+            pthread_cond_signal(&dns_cond);
+        else if (dns_threads < DNS_MAX_THREADS)
+            dns_spawn_worker();
+
+        if (!dns_threads) {
+            /* Nobody to serve it, drop the entry so that a later query retries the spawn */
+            if (queued) {
+                list_del_init(&e->work);
+                dns_cache[bucket] = e->next;
+                free(e);
+            }
+            dns_loop_put(dl);
+            goto err;
+        }
+    }
+
+    q->dl = dl;
+    list_add_tail(&q->list, &e->waiters);
+
+    pthread_mutex_unlock(&dns_lock);
+
+    return 1;
+
+err:
+    pthread_mutex_unlock(&dns_lock);
+    log_err("Failed to start the lookup of %s\n", host);
+    return -1;
+}
+
+void dns_cancel(struct dns_query *q)
+{
+    pthread_mutex_lock(&dns_lock);
+
+    if (q->dl) {
+        list_del_init(&q->list);
+        dns_loop_put(q->dl);
+        q->dl = NULL;
+    }
+
+    pthread_mutex_unlock(&dns_lock);
+}
+
+void uwsc_set_dns_ttl(int positive, int negative)
+{
+    pthread_mutex_lock(&dns_lock);
+    positive_ttl = positive;
+    negative_ttl = negative;
+    pthread_mutex_unlock(&dns_lock);
+}
@@ -0,0 +1,83 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _RESOLVER_H
+#define _RESOLVER_H
+
+#include <ev.h>
+#include <netinet/in.h>
+
+#include "list.h"
+
+#define DNS_MAX_ADDRS       8
+#define DNS_MAX_THREADS     4
+#define DNS_CACHE_BUCKETS   256
+
+/* Default lifetime of cached answers in seconds */
+#define DNS_POSITIVE_TTL    60
+#define DNS_NEGATIVE_TTL    5
+
+union dns_addr {
+    struct sockaddr sa;
+    struct sockaddr_in sin;
+    struct sockaddr_in6 sin6;
+};
+
+struct dns_loop;
+
+struct dns_query {
+    struct list_head list;      /* Waiting on a lookup, then on the loop's done list */
+    struct dns_loop *dl;        /* Set while the answer is pending */
+    void (*cb)(struct dns_query *q);
+    void *data;
+    int port;
+    int error;                  /* 0 or an EAI_* code */
+    int naddrs;
+    union dns_addr addrs[DNS_MAX_ADDRS];
+};
+
+/*
+ *  dns_resolve - look up @host without blocking the loop
+ *
+ *  Numeric hosts and cached answers are filled in right away. Otherwise the
+ *  lookup runs on a helper thread and @cb is called from @loop with the answer
+ *  in @q. Concurrent lookups of the same host share one getaddrinfo call.
+ *
+ *  Return 0 if @q was answered right away, 1 if @cb will be called, -1 on error.
+ *  When answered right away @q->error tells whether the lookup succeeded.
+ */
+int dns_resolve(struct ev_loop *loop, struct dns_query *q, const char *host, int port,
+    void (*cb)(struct dns_query *q));
+
+/* Drop a pending query, @cb will not be called. Must be called from the query's loop */
+void dns_cancel(struct dns_query *q);
+
+static inline socklen_t dns_addr_len(const union dns_addr *addr)
+{
+    if (addr->sa.sa_family == AF_INET6)
+        return sizeof(struct sockaddr_in6);
+    return sizeof(struct sockaddr_in);
+}
+
+#endif
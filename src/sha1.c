@@ -25,10 +25,32 @@
  */
 
 #include <string.h>
+#include <stdbool.h>
 #include <arpa/inet.h>
 
 #include "sha1.h"
 
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || __GNUC__ >= 5)
+#define SHA1_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__linux__) && (defined(__clang__) || __GNUC__ >= 6)
+#define SHA1_ARM
+#include <sys/auxv.h>
+#include <arm_neon.h>
+#ifndef HWCAP_SHA1
+#define HWCAP_SHA1  (1 << 5)
+#endif
+#ifdef __clang__
+#define SHA1_ARM_TARGET __attribute__((target("crypto")))
+#else
+#define SHA1_ARM_TARGET __attribute__((target("+crypto")))
+#endif
+#endif
+
+/* Process @blocks consecutive 64 byte blocks */
+typedef void (*sha1_blocks_t)(uint32_t state[5], const uint8_t *data, size_t blocks);
+
 union char64long16 {
     uint8_t c[64];
     uint32_t l[16];
@@ -166,6 +188,204 @@ static void sha1_transform(uint32_t state[5], const uint8_t buffer[64])
     a = b = c = d = e = 0;
 }
 
+static void sha1_blocks_generic(uint32_t state[5], const uint8_t *data, size_t blocks)
+{
+    while (blocks--) {
+        sha1_transform(state, data);
+        data += 64;
+    }
+}
+
+#ifdef SHA1_X86
+/* Four rounds with message schedule, M0 holds the words of these rounds */
+#define SHANI_ROUNDS(Ea, Eb, M0, M1, M2, M3, f)     \
+    Ea = _mm_sha1nexte_epu32(Ea, M0);               \
+    Eb = abcd;                                      \
+    M1 = _mm_sha1msg2_epu32(M1, M0);                \
+    abcd = _mm_sha1rnds4_epu32(abcd, Ea, f);        \
+    M3 = _mm_sha1msg1_epu32(M3, M0);                \
+    M2 = _mm_xor_si128(M2, M0);
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha1_blocks_shani(uint32_t state[5], const uint8_t *data, size_t blocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd, abcd_save, e0, e0_save, e1;
+    __m128i m0, m1, m2, m3;
+
+    abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1B);
+    e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+    while (blocks--) {
+        abcd_save = abcd;
+        e0_save = e0;
+
+        m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 0)), mask);
+        m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), mask);
+        m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), mask);
+        m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), mask);
+
+        /* Rounds 0 - 11 */
+        e0 = _mm_add_epi32(e0, m0);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+        e1 = _mm_sha1nexte_epu32(e1, m1);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+        m0 = _mm_sha1msg1_epu32(m0, m1);
+
+        e0 = _mm_sha1nexte_epu32(e0, m2);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        m1 = _mm_sha1msg1_epu32(m1, m2);
+        m0 = _mm_xor_si128(m0, m2);
+
+        /* Rounds 12 - 63 */
+        SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 0);
+        SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 0);
+        SHANI_ROUNDS(e1, e0, m1, m2, m3, m0, 1);
+        SHANI_ROUNDS(e0, e1, m2, m3, m0, m1, 1);
+        SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 1);
+        SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 1);
+        SHANI_ROUNDS(e1, e0, m1, m2, m3, m0, 1);
+        SHANI_ROUNDS(e0, e1, m2, m3, m0, m1, 2);
+        SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 2);
+        SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 2);
+        SHANI_ROUNDS(e1, e0, m1, m2, m3, m0, 2);
+        SHANI_ROUNDS(e0, e1, m2, m3, m0, m1, 2);
+        SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 3);
+
+        /* Rounds 64 - 79, winding down the schedule */
+        e0 = _mm_sha1nexte_epu32(e0, m0);
+        e1 = abcd;
+        m1 = _mm_sha1msg2_epu32(m1, m0);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+        m3 = _mm_sha1msg1_epu32(m3, m0);
+        m2 = _mm_xor_si128(m2, m0);
+
+        e1 = _mm_sha1nexte_epu32(e1, m1);
+        e0 = abcd;
+        m2 = _mm_sha1msg2_epu32(m2, m1);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+        m3 = _mm_xor_si128(m3, m1);
+
+        e0 = _mm_sha1nexte_epu32(e0, m2);
+        e1 = abcd;
+        m3 = _mm_sha1msg2_epu32(m3, m2);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+        e1 = _mm_sha1nexte_epu32(e1, m3);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+        e0 = _mm_sha1nexte_epu32(e0, e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+
+        data += 64;
+    }
+
+    _mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = _mm_extract_epi32(e0, 3);
+}
+
+static bool sha1_has_shani(void)
+{
+    unsigned int a, b, c, d;
+
+    if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSSE3) || !(c & bit_SSE4_1))
+        return false;
+
+    if (__get_cpuid_max(0, NULL) < 7)
+        return false;
+
+    __cpuid_count(7, 0, a, b, c, d);
+
+    return b & (1 << 29);   /* SHA */
+}
+#endif
+
+#ifdef SHA1_ARM
+SHA1_ARM_TARGET
+static void sha1_blocks_armv8(uint32_t state[5], const uint8_t *data, size_t blocks)
+{
+    static const uint32_t k[4] = { 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+    uint32x4_t abcd, abcd_save, w[20];
+    uint32_t e, e_save;
+    int i;
+
+    abcd = vld1q_u32(state);
+    e = state[4];
+
+    while (blocks--) {
+        abcd_save = abcd;
+        e_save = e;
+
+        for (i = 0; i < 4; i++)
+            w[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+
+        for (i = 4; i < 20; i++)
+            w[i] = vsha1su1q_u32(vsha1su0q_u32(w[i - 4], w[i - 3], w[i - 2]), w[i - 1]);
+
+        /* Four rounds per step: choose, parity, majority, parity */
+        for (i = 0; i < 20; i++) {
+            uint32x4_t wk = vaddq_u32(w[i], vdupq_n_u32(k[i / 5]));
+            uint32_t e_next = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+
+            if (i < 5)
+                abcd = vsha1cq_u32(abcd, e, wk);
+            else if (i >= 10 && i < 15)
+                abcd = vsha1mq_u32(abcd, e, wk);
+            else
+                abcd = vsha1pq_u32(abcd, e, wk);
+
+            e = e_next;
+        }
+
+        abcd = vaddq_u32(abcd, abcd_save);
+        e += e_save;
+
+        data += 64;
+    }
+
+    vst1q_u32(state, abcd);
+    state[4] = e;
+}
+#endif
+
+static sha1_blocks_t sha1_select(void)
+{
+#ifdef SHA1_X86
+    if (sha1_has_shani())
+        return sha1_blocks_shani;
+#endif
+
+#ifdef SHA1_ARM
+    if (getauxval(AT_HWCAP) & HWCAP_SHA1)
+        return sha1_blocks_armv8;
+#endif
+
+    return sha1_blocks_generic;
+}
+
+static void sha1_blocks_resolve(uint32_t state[5], const uint8_t *data, size_t blocks);
+
+/* Resolved to the best implementation for this CPU on first use */
+static sha1_blocks_t sha1_blocks_impl = sha1_blocks_resolve;
+
+static void sha1_blocks_resolve(uint32_t state[5], const uint8_t *data, size_t blocks)
+{
+    sha1_blocks_t impl = sha1_select();
+
+    __atomic_store_n(&sha1_blocks_impl, impl, __ATOMIC_RELAXED);
+    impl(state, data, blocks);
+}
+
+static inline void sha1_blocks(uint32_t state[5], const uint8_t *data, size_t blocks)
+{
+    __atomic_load_n(&sha1_blocks_impl, __ATOMIC_RELAXED)(state, data, blocks);
+}
+
 void sha1_init(struct sha1_ctx *ctx)
 {
     ctx->state[0] = 0x67452301;
@@ -192,9 +412,11 @@ void sha1_update(struct sha1_ctx *ctx, const void *data, size_t len)
     if ((j + len) > 63) {
         i = 64 - j;
         memcpy(ctx->buffer + j, data, i);
-        sha1_transform(ctx->state, ctx->buffer);
-        for (; i + 63 < len; i += 64)
-            sha1_transform(ctx->state, data + i);
+        sha1_blocks(ctx->state, ctx->buffer, 1);
+        if (len - i >= 64) {
+            sha1_blocks(ctx->state, data + i, (len - i) / 64);
+            i += (len - i) & ~(size_t)63;
+        }
         j = 0;
     } else {
         i = 0;
@@ -205,7 +427,8 @@ void sha1_update(struct sha1_ctx *ctx, const void *data, size_t len)
 
 void sha1_final(struct sha1_ctx *ctx, uint8_t digest[20])
 {
-    unsigned i;
+    static const uint8_t zeros[64];
+    unsigned i, j;
     unsigned char finalcount[8], c;
 
     for (i = 0; i < 8; i++) {
@@ -214,10 +437,11 @@ void sha1_final(struct sha1_ctx *ctx, uint8_t digest[20])
 
     c = 0200;
     sha1_update(ctx, &c, 1);
-    while ((ctx->count[0] & 504) != 448) {
-        c = 0000;
-        sha1_update(ctx, &c, 1);
-    }
+
+    /* Zeros up to 8 bytes short of the block end, in one go */
+    j = (ctx->count[0] >> 3) & 63;
+    sha1_update(ctx, zeros, j <= 56 ? 56 - j : 120 - j);
+
     sha1_update(ctx, finalcount, 8);
     for (i = 0; i < 20; i++) {
         digest[i] = (unsigned char) ((ctx->state[i >> 2] >> ((3 - (i & 3)) * 8)) & 255);
@@ -31,7 +31,7 @@
 
 struct sha1_ctx {
     uint32_t state[5];
-    size_t count[2];
+    uint32_t count[2];      /* Message length in bits, low word first */
     uint8_t buffer[64];
 };
 
@@ -0,0 +1,182 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#ifdef SSL_SUPPORT
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "uwsc.h"
+#include "sslcache.h"
+#include "sslresume.h"
+
+struct sslcache_entry {
+    struct sslcache_entry *next;
+    void *session;
+    double expires;
+    int port;
+    char host[];
+};
+
+static pthread_mutex_t sslcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sslcache_entry *sslcache[SSLCACHE_BUCKETS];
+static int sslcache_entries;
+static uint64_t sslcache_hits;
+static uint64_t sslcache_misses;
+
+static double sslcache_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned int sslcache_hash(const char *host, int port)
+{
+    unsigned int h = 2166136261u ^ port;
+
+    while (*host)
+        h = (h ^ (unsigned char)*host++) * 16777619u;
+
+    return h % SSLCACHE_BUCKETS;
+}
+
+/* Find the entry of @host:@port, dropping expired entries of its bucket on the way */
+static struct sslcache_entry **sslcache_lookup(const char *host, int port, double now)
+{
+    struct sslcache_entry **pe = &sslcache[sslcache_hash(host, port)];
+    struct sslcache_entry *e;
+
+    while ((e = *pe)) {
+        if (e->expires <= now) {
+            *pe = e->next;
+            ssl_resume_free(e->session);
+            free(e);
+            sslcache_entries--;
+            continue;
+        }
+
+        if (e->port == port && !strcmp(e->host, host))
+            break;
+
+        pe = &e->next;
+    }
+
+    return pe;
+}
+
+void sslcache_resume(void *ssl, const char *host, int port)
+{
+    struct sslcache_entry *e;
+
+    pthread_mutex_lock(&sslcache_lock);
+
+    e = *sslcache_lookup(host, port, sslcache_now());
+    if (e)
+        ssl_resume_set(ssl, e->session);
+
+    pthread_mutex_unlock(&sslcache_lock);
+}
+
+void sslcache_save(void *ssl, const char *host, int port)
+{
+    struct sslcache_entry **pe, *e;
+    void *s = ssl_resume_get(ssl);
+    double now;
+
+    if (!s)
+        return;
+
+    pthread_mutex_lock(&sslcache_lock);
+
+    now = sslcache_now();
+    pe = sslcache_lookup(host, port, now);
+    e = *pe;
+
+    if (e) {
+        /* Resumed, keep the original lifetime */
+        if (e->session == s) {
+            ssl_resume_free(s);
+            goto out;
+        }
+
+        ssl_resume_free(e->session);
+    } else {
+        if (sslcache_entries >= SSLCACHE_MAX_ENTRIES) {
+            ssl_resume_free(s);
+            goto out;
+        }
+
+        e = calloc(1, sizeof(struct sslcache_entry) + strlen(host) + 1);
+        if (!e) {
+            ssl_resume_free(s);
+            goto out;
+        }
+
+        strcpy(e->host, host);
+        e->port = port;
+        *pe = e;
+        sslcache_entries++;
+    }
+
+    e->session = s;
+    e->expires = now + SSLCACHE_TTL;
+
+out:
+    pthread_mutex_unlock(&sslcache_lock);
+}
+
+void sslcache_handshaked(void *ssl, const char *host, int port)
+{
+    bool reused = ssl_resume_reused(ssl);
+
+    pthread_mutex_lock(&sslcache_lock);
+
+    if (reused)
+        sslcache_hits++;
+    else
+        sslcache_misses++;
+
+    pthread_mutex_unlock(&sslcache_lock);
+
+    sslcache_save(ssl, host, port);
+}
+
+void uwsc_ssl_session_stats(struct uwsc_ssl_session_stats *st)
+{
+    pthread_mutex_lock(&sslcache_lock);
+    st->hits = sslcache_hits;
+    st->misses = sslcache_misses;
+    st->entries = sslcache_entries;
+    pthread_mutex_unlock(&sslcache_lock);
+}
+
+#endif
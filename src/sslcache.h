@@ -0,0 +1,54 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _SSLCACHE_H
+#define _SSLCACHE_H
+
+#include "config.h"
+
+#ifdef SSL_SUPPORT
+
+#define SSLCACHE_BUCKETS        256
+#define SSLCACHE_MAX_ENTRIES    1024
+
+/* Seconds a session is offered for, servers usually keep them at least this long */
+#define SSLCACHE_TTL            300
+
+/*
+ * TLS sessions shared by all clients of the process, keyed by host:port,
+ * so that reconnects resume with an abbreviated handshake.
+ */
+
+/* Offer the cached session of @host:@port on the new @ssl, before its handshake */
+void sslcache_resume(void *ssl, const char *host, int port);
+
+/* The handshake of @ssl completed: count it as a hit or a miss and save its session */
+void sslcache_handshaked(void *ssl, const char *host, int port);
+
+/* Save the session of @ssl, e.g. a TLS 1.3 ticket received after the handshake */
+void sslcache_save(void *ssl, const char *host, int port);
+
+#endif
+
+#endif
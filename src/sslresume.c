@@ -0,0 +1,101 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#ifdef SSL_SUPPORT
+
+#include <stddef.h>
+
+#include "sslresume.h"
+
+/*
+ * The SSL layer's session handle is the backend's own object: an SSL for
+ * OpenSSL and for wolfSSL through its OpenSSL compatibility layer. The
+ * backend is told by the macros the SSL layer defines.
+ */
+#if defined(SSL_USE_WOLFSSL) || defined(HAVE_WOLFSSL)
+#define SSLRESUME_OPENSSL_API
+#include <wolfssl/options.h>
+#include <wolfssl/openssl/ssl.h>
+#elif defined(SSL_USE_OPENSSL) || defined(HAVE_OPENSSL)
+#define SSLRESUME_OPENSSL_API
+#include <openssl/ssl.h>
+#elif defined(SSL_USE_MBEDTLS) || defined(HAVE_MBEDTLS)
+/* The mbedTLS backend wraps its context, there is no session to reach */
+#else
+#warning "Unknown SSL backend, TLS sessions will not be resumed"
+#endif
+
+#ifdef SSLRESUME_OPENSSL_API
+void *ssl_resume_get(void *ssl)
+{
+    SSL_SESSION *s = SSL_get1_session(ssl);
+
+#if defined(OPENSSL_VERSION_NUMBER) && !defined(LIBWOLFSSL_VERSION_HEX) && \
+    OPENSSL_VERSION_NUMBER >= 0x10101000L
+    if (s && !SSL_SESSION_is_resumable(s)) {
+        SSL_SESSION_free(s);
+        return NULL;
+    }
+#endif
+
+    return s;
+}
+
+void ssl_resume_set(void *ssl, void *session)
+{
+    SSL_set_session(ssl, session);
+}
+
+bool ssl_resume_reused(void *ssl)
+{
+    return SSL_session_reused(ssl);
+}
+
+void ssl_resume_free(void *session)
+{
+    SSL_SESSION_free(session);
+}
+#else
+void *ssl_resume_get(void *ssl)
+{
+    return NULL;
+}
+
+void ssl_resume_set(void *ssl, void *session)
+{
+}
+
+bool ssl_resume_reused(void *ssl)
+{
+    return false;
+}
+
+void ssl_resume_free(void *session)
+{
+}
+#endif
+
+#endif
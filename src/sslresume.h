@@ -0,0 +1,52 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _SSLRESUME_H
+#define _SSLRESUME_H
+
+#include <stdbool.h>
+
+#include "config.h"
+
+#ifdef SSL_SUPPORT
+
+/*
+ * Session resumption on top of the SSL layer, which doesn't expose it.
+ * Sessions are opaque, a backend without support returns none.
+ */
+
+/* A reference to the session of @ssl if it can be resumed, NULL otherwise */
+void *ssl_resume_get(void *ssl);
+
+/* Offer @session on the new @ssl, before its handshake */
+void ssl_resume_set(void *ssl, void *session);
+
+/* The handshake of @ssl was abbreviated */
+bool ssl_resume_reused(void *ssl);
+
+void ssl_resume_free(void *session);
+
+#endif
+
+#endif
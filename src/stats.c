@@ -0,0 +1,327 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#ifdef UWSC_STATS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "stats.h"
+
+/*
+ * The clients of each loop, so that the loop totals are summed when asked
+ * for instead of counted twice on the hot paths. A loop's entry is kept
+ * for the life of the process, so its counters never go backwards.
+ */
+struct stats_loop {
+    struct list_head node;
+    struct ev_loop *loop;
+    uint32_t next_id;
+    struct list_head clients;
+    struct uwsc_stats retired;  /* Left by the clients freed so far */
+};
+
+#define STATS_NONE  ((size_t)-1)
+
+struct stats_metric {
+    const char *name;
+    const char *type;
+    const char *help;
+    size_t in;                  /* Offset in struct uwsc_stats */
+    size_t out;                 /* Of the outgoing side, STATS_NONE if there is no direction */
+    bool per_opcode;
+};
+
+#define STATS_FIELD(f)  offsetof(struct uwsc_stats, f)
+
+static const struct stats_metric stats_metrics[] = {
+    { "frames_total", "counter", "WebSocket frames",
+        STATS_FIELD(frames_in), STATS_FIELD(frames_out), true },
+    { "payload_bytes_total", "counter", "Frame payload bytes, compressed if permessage-deflate is on",
+        STATS_FIELD(payload_in), STATS_FIELD(payload_out), true },
+    { "socket_bytes_total", "counter", "Bytes read from and written to the connection, after TLS",
+        STATS_FIELD(bytes_read), STATS_FIELD(bytes_written) },
+    { "reads_total", "counter", "Read calls",
+        STATS_FIELD(reads), STATS_NONE },
+    { "writes_total", "counter", "Write calls",
+        STATS_FIELD(writes), STATS_NONE },
+    { "partial_writes_total", "counter", "Writes that took less than offered",
+        STATS_FIELD(partial_writes), STATS_NONE },
+    { "rb_peak_bytes", "gauge", "Largest capacity of the read buffer",
+        STATS_FIELD(rb_peak), STATS_NONE },
+    { "wb_peak_bytes", "gauge", "Largest capacity of the write buffer",
+        STATS_FIELD(wb_peak), STATS_NONE },
+    { "reconnects_total", "counter", "Reconnects scheduled",
+        STATS_FIELD(reconnects), STATS_NONE },
+    { "ping_timeouts_total", "counter", "Pings not answered in time",
+        STATS_FIELD(ping_timeouts), STATS_NONE },
+    { "handshake_failures_total", "counter", "Refused or invalid upgrade responses and handshake timeouts",
+        STATS_FIELD(handshake_failures), STATS_NONE }
+};
+
+#define STATS_NMETRICS  (sizeof(stats_metrics) / sizeof(stats_metrics[0]))
+
+static const char *stats_opcodes[UWSC_STATS_OPCODES] = {
+    "continue", "text", "binary", "close", "ping", "pong"
+};
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct list_head stats_loops = LIST_HEAD_INIT(stats_loops);
+
+static struct stats_loop *stats_find(struct ev_loop *loop, bool create)
+{
+    struct stats_loop *sl = NULL;
+    struct list_head *p, *n;
+
+    pthread_mutex_lock(&stats_lock);
+
+    list_for_each_safe(p, n, &stats_loops) {
+        sl = list_entry(p, struct stats_loop, node);
+        if (sl->loop == loop)
+            goto out;
+    }
+
+    sl = NULL;
+    if (!create)
+        goto out;
+
+    sl = calloc(1, sizeof(struct stats_loop));
+    if (!sl)
+        goto out;
+
+    sl->loop = loop;
+    INIT_LIST_HEAD(&sl->clients);
+    list_add(&sl->node, &stats_loops);
+
+out:
+    pthread_mutex_unlock(&stats_lock);
+    return sl;
+}
+
+static void stats_merge(struct uwsc_stats *dst, const struct uwsc_stats *src)
+{
+    int i;
+
+    for (i = 0; i < UWSC_STATS_OPCODES; i++) {
+        dst->frames_in[i] += src->frames_in[i];
+        dst->frames_out[i] += src->frames_out[i];
+        dst->payload_in[i] += src->payload_in[i];
+        dst->payload_out[i] += src->payload_out[i];
+    }
+
+    dst->bytes_read += src->bytes_read;
+    dst->bytes_written += src->bytes_written;
+    dst->reads += src->reads;
+    dst->writes += src->writes;
+    dst->partial_writes += src->partial_writes;
+    dst->reconnects += src->reconnects;
+    dst->ping_timeouts += src->ping_timeouts;
+    dst->handshake_failures += src->handshake_failures;
+
+    if (src->rb_peak > dst->rb_peak)
+        dst->rb_peak = src->rb_peak;
+    if (src->wb_peak > dst->wb_peak)
+        dst->wb_peak = src->wb_peak;
+}
+
+int stats_register(struct uwsc_client *cl)
+{
+    struct stats_loop *sl = stats_find(cl->loop, true);
+
+    if (!sl)
+        return -1;
+
+    cl->stats_loop = sl;
+    cl->stats_id = ++sl->next_id;
+    list_add_tail(&cl->stats_node, &sl->clients);
+
+    return 0;
+}
+
+void stats_unregister(struct uwsc_client *cl)
+{
+    struct stats_loop *sl = cl->stats_loop;
+
+    if (!sl)
+        return;
+
+    stats_merge(&sl->retired, &cl->stats);
+    list_del_init(&cl->stats_node);
+    cl->stats_loop = NULL;
+}
+
+static void stats_sum(struct stats_loop *sl, struct uwsc_stats *st, int *nclients)
+{
+    struct list_head *p, *n;
+
+    *st = sl->retired;
+    *nclients = 0;
+
+    list_for_each_safe(p, n, &sl->clients) {
+        struct uwsc_client *cl = list_entry(p, struct uwsc_client, stats_node);
+
+        stats_merge(st, &cl->stats);
+        (*nclients)++;
+    }
+}
+
+void uwsc_loop_stats(struct ev_loop *loop, struct uwsc_stats *st)
+{
+    struct stats_loop *sl = stats_find(loop ? loop : EV_DEFAULT, false);
+    int nclients;
+
+    memset(st, 0, sizeof(struct uwsc_stats));
+
+    if (sl)
+        stats_sum(sl, st, &nclients);
+}
+
+static inline uint64_t stats_value(const struct uwsc_stats *st, size_t off, int i)
+{
+    return ((const uint64_t *)((const char *)st + off))[i];
+}
+
+/* One sample, @labels and @extra are comma separated label pairs or empty */
+static int stats_line(struct buffer *out, const char *family, const char *labels,
+    const char *extra, uint64_t v)
+{
+    if (!*labels && !*extra)
+        return buffer_put_printf(out, "%s %" PRIu64 "\n", family, v);
+
+    return buffer_put_printf(out, "%s{%s%s%s} %" PRIu64 "\n", family, labels,
+        *labels && *extra ? "," : "", extra, v);
+}
+
+static int stats_render_metric(struct buffer *out, const char *family,
+    const struct stats_metric *m, const char *labels, const struct uwsc_stats *st)
+{
+    char extra[64];
+    int i;
+
+    if (m->per_opcode) {
+        for (i = 0; i < UWSC_STATS_OPCODES; i++) {
+            snprintf(extra, sizeof(extra), "direction=\"in\",opcode=\"%s\"", stats_opcodes[i]);
+            if (stats_line(out, family, labels, extra, stats_value(st, m->in, i)) < 0)
+                return -1;
+
+            snprintf(extra, sizeof(extra), "direction=\"out\",opcode=\"%s\"", stats_opcodes[i]);
+            if (stats_line(out, family, labels, extra, stats_value(st, m->out, i)) < 0)
+                return -1;
+        }
+        return 0;
+    }
+
+    if (m->out != STATS_NONE) {
+        if (stats_line(out, family, labels, "direction=\"in\"", stats_value(st, m->in, 0)) < 0 ||
+            stats_line(out, family, labels, "direction=\"out\"", stats_value(st, m->out, 0)) < 0)
+            return -1;
+        return 0;
+    }
+
+    return stats_line(out, family, labels, "", stats_value(st, m->in, 0));
+}
+
+/* Label values may hold anything but a backslash, a quote or a newline unescaped */
+static void stats_escape(char *dst, size_t size, const char *src)
+{
+    char *end = dst + size - 1;
+
+    while (*src && dst < end) {
+        char c = *src++;
+
+        if (c == '\\' || c == '"' || c == '\n') {
+            if (end - dst < 2)
+                break;
+            *dst++ = '\\';
+            c = c == '\n' ? 'n' : c;
+        }
+
+        *dst++ = c;
+    }
+
+    *dst = '\0';
+}
+
+int uwsc_stats_render(struct ev_loop *loop, struct buffer *out, int flags)
+{
+    struct stats_loop *sl = stats_find(loop ? loop : EV_DEFAULT, false);
+    struct uwsc_stats total = {};
+    char family[64];
+    char labels[384];
+    char host[256];
+    int nclients = 0;
+    size_t i;
+
+    if (sl)
+        stats_sum(sl, &total, &nclients);
+
+    if (buffer_put_printf(out, "# HELP uwsc_clients Clients alive\n"
+        "# TYPE uwsc_clients gauge\nuwsc_clients %d\n", nclients) < 0)
+        return -1;
+
+    for (i = 0; i < STATS_NMETRICS; i++) {
+        const struct stats_metric *m = &stats_metrics[i];
+
+        snprintf(family, sizeof(family), "uwsc_%s", m->name);
+
+        if (buffer_put_printf(out, "# HELP %s %s\n# TYPE %s %s\n", family, m->help, family, m->type) < 0 ||
+            stats_render_metric(out, family, m, "", &total) < 0)
+            return -1;
+    }
+
+    if (!(flags & UWSC_STATS_CLIENTS) || !sl)
+        return 0;
+
+    for (i = 0; i < STATS_NMETRICS; i++) {
+        const struct stats_metric *m = &stats_metrics[i];
+        struct list_head *p, *n;
+
+        snprintf(family, sizeof(family), "uwsc_client_%s", m->name);
+
+        if (buffer_put_printf(out, "# HELP %s %s, per client\n# TYPE %s %s\n",
+            family, m->help, family, m->type) < 0)
+            return -1;
+
+        list_for_each_safe(p, n, &sl->clients) {
+            struct uwsc_client *cl = list_entry(p, struct uwsc_client, stats_node);
+
+            stats_escape(host, sizeof(host), cl->host ? cl->host : "");
+            snprintf(labels, sizeof(labels), "client=\"%" PRIu32 "\",host=\"%s\",port=\"%d\"",
+                cl->stats_id, host, cl->port);
+
+            if (stats_render_metric(out, family, m, labels, &cl->stats) < 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include "uwsc.h"
+
+/*
+ * Traffic counters, compiled in with UWSC_STATS. Without it the hooks
+ * below expand to nothing and struct uwsc_client carries no counters.
+ */
+
+#ifdef UWSC_STATS
+
+/* Account @cl to its loop, its counters stay in the loop totals once unregistered */
+int stats_register(struct uwsc_client *cl);
+void stats_unregister(struct uwsc_client *cl);
+
+static inline int stats_slot(int op)
+{
+    if (op <= UWSC_OP_BINARY)
+        return op;
+
+    if (op >= UWSC_OP_CLOSE && op <= UWSC_OP_PONG)
+        return op - UWSC_OP_CLOSE + UWSC_STATS_CLOSE;
+
+    return -1;
+}
+
+static inline void stats_frame_in(struct uwsc_client *cl, int op, uint64_t len)
+{
+    int i = stats_slot(op);
+
+    if (i >= 0) {
+        cl->stats.frames_in[i]++;
+        cl->stats.payload_in[i] += len;
+    }
+}
+
+static inline void stats_frame_out(struct uwsc_client *cl, int op, uint64_t len)
+{
+    int i = stats_slot(op);
+
+    if (i >= 0) {
+        cl->stats.frames_out[i]++;
+        cl->stats.payload_out[i] += len;
+    }
+}
+
+#define stats_add(cl, field, n)     ((cl)->stats.field += (n))
+
+#define stats_peak(cl, field, v)                \
+    do {                                        \
+        if ((v) > (cl)->stats.field)            \
+            (cl)->stats.field = (v);            \
+    } while (0)
+
+#else
+
+#define stats_register(cl)              0
+#define stats_unregister(cl)            do {} while (0)
+#define stats_frame_in(cl, op, len)     do {} while (0)
+#define stats_frame_out(cl, op, len)    do {} while (0)
+#define stats_add(cl, field, n)         do {} while (0)
+#define stats_peak(cl, field, v)        do {} while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,309 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "timerwheel.h"
+
+struct twheel {
+    struct list_head node;
+    struct ev_loop *loop;
+    struct ev_timer timer;
+    ev_tstamp base;         /* Loop time of tick 0 */
+    uint64_t now;           /* Last tick processed */
+    uint64_t armed;         /* Tick the ev_timer is armed for */
+    bool running;
+    int refs;
+    int count;
+    uint64_t bitmap[TW_LEVELS];
+    struct list_head slots[TW_LEVELS][TW_SLOTS];
+};
+
+static pthread_mutex_t twheel_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct list_head twheels = LIST_HEAD_INIT(twheels);
+
+static inline uint64_t tw_current(struct twheel *tw)
+{
+    /* A hair of slack so that waking up right on a tick counts as reaching it */
+    return (ev_now(tw->loop) - tw->base) / TW_TICK + 1e-3;
+}
+
+static inline uint64_t ror64(uint64_t x, unsigned int r)
+{
+    r &= 63;
+    return r ? (x >> r) | (x << (64 - r)) : x;
+}
+
+static void tw_add(struct twheel *tw, struct tw_timer *t)
+{
+    uint64_t max = (1ULL << (TW_BITS * TW_LEVELS)) - 1;
+    uint64_t delta;
+    int level;
+
+    if (t->expires < tw->now)
+        t->expires = tw->now;
+
+    delta = t->expires - tw->now;
+    if (delta > max) {
+        delta = max;
+        t->expires = tw->now + max;
+    }
+
+    for (level = 0; level < TW_LEVELS - 1; level++) {
+        if (delta < (1ULL << (TW_BITS * (level + 1))))
+            break;
+    }
+
+    t->level = level;
+    t->slot = (t->expires >> (TW_BITS * level)) & (TW_SLOTS - 1);
+
+    list_add_tail(&t->list, &tw->slots[level][t->slot]);
+    tw->bitmap[level] |= 1ULL << t->slot;
+}
+
+static void tw_del(struct twheel *tw, struct tw_timer *t)
+{
+    list_del_init(&t->list);
+
+    if (list_empty(&tw->slots[t->level][t->slot]))
+        tw->bitmap[t->level] &= ~(1ULL << t->slot);
+}
+
+/*
+ * The next tick with work: the expiry of the first level 0 timer or the
+ * tick a higher level slot is due to be cascaded down.
+ */
+static uint64_t tw_next(struct twheel *tw)
+{
+    uint64_t next = UINT64_MAX;
+    int level;
+
+    for (level = 0; level < TW_LEVELS; level++) {
+        int shift = TW_BITS * level;
+        uint64_t base, t;
+
+        if (!tw->bitmap[level])
+            continue;
+
+        base = (tw->now >> shift) + 1;
+        t = (base + __builtin_ctzll(ror64(tw->bitmap[level], base))) << shift;
+        if (t < next)
+            next = t;
+    }
+
+    return next;
+}
+
+static void tw_cascade(struct twheel *tw, int level)
+{
+    int slot = (tw->now >> (TW_BITS * level)) & (TW_SLOTS - 1);
+    struct list_head *head = &tw->slots[level][slot];
+    struct list_head *p, *n;
+
+    tw->bitmap[level] &= ~(1ULL << slot);
+
+    list_for_each_safe(p, n, head) {
+        struct tw_timer *t = list_entry(p, struct tw_timer, list);
+
+        list_del_init(&t->list);
+        tw_add(tw, t);
+    }
+}
+
+static void tw_rearm(struct twheel *tw)
+{
+    uint64_t next;
+    double after;
+
+    if (tw->running)
+        return;
+
+    if (!tw->count) {
+        ev_timer_stop(tw->loop, &tw->timer);
+        return;
+    }
+
+    next = tw_next(tw);
+    if (ev_is_active(&tw->timer) && tw->armed == next)
+        return;
+
+    after = tw->base + next * TW_TICK - ev_now(tw->loop);
+    if (after < 0)
+        after = 0;
+
+    ev_timer_stop(tw->loop, &tw->timer);
+    ev_timer_set(&tw->timer, after, 0.0);
+    ev_timer_start(tw->loop, &tw->timer);
+    tw->armed = next;
+}
+
+static void tw_run(struct twheel *tw, uint64_t target)
+{
+    struct list_head expired;
+    int level;
+
+    while (tw->count > 0) {
+        uint64_t next = tw_next(tw);
+
+        if (next > target)
+            break;
+
+        tw->now = next;
+
+        /* Refill the lower levels, starting from the top */
+        for (level = TW_LEVELS - 1; level > 0; level--) {
+            if (!(next & ((1ULL << (TW_BITS * level)) - 1)))
+                tw_cascade(tw, level);
+        }
+
+        INIT_LIST_HEAD(&expired);
+        list_splice_init(&tw->slots[0][next & (TW_SLOTS - 1)], &expired);
+        tw->bitmap[0] &= ~(1ULL << (next & (TW_SLOTS - 1)));
+
+        /* Callbacks may start and stop timers, including those still in expired */
+        while (!list_empty(&expired)) {
+            struct tw_timer *t = list_first_entry(&expired, struct tw_timer, list);
+
+            list_del_init(&t->list);
+            t->active = false;
+            tw->count--;
+            t->cb(t);
+        }
+    }
+
+    tw->now = target;
+}
+
+static void tw_timer_cb(struct ev_loop *loop, struct ev_timer *w, int revents)
+{
+    struct twheel *tw = container_of(w, struct twheel, timer);
+
+    /* Hold on to the wheel, callbacks may free the last client using it */
+    tw->refs++;
+    tw->running = true;
+
+    tw_run(tw, tw_current(tw));
+
+    tw->running = false;
+    tw_rearm(tw);
+    twheel_put(tw);
+}
+
+void tw_timer_start(struct tw_timer *t, double after)
+{
+    struct twheel *tw = t->tw;
+    double at;
+
+    /* The owner let go of the wheel, e.g. a client after uwsc_free() */
+    if (!tw)
+        return;
+
+    if (t->active) {
+        tw_del(tw, t);
+        tw->count--;
+    }
+
+    /* Nothing pending, the wheel may have slept through many ticks */
+    if (!tw->count && !tw->running)
+        tw->now = tw_current(tw);
+
+    /* Round up, a timer never fires early */
+    at = (ev_now(tw->loop) - tw->base + (after > 0 ? after : 0)) / TW_TICK;
+    t->expires = at;
+    if (t->expires < at)
+        t->expires++;
+
+    if (t->expires <= tw->now)
+        t->expires = tw->now + 1;
+
+    tw_add(tw, t);
+    t->active = true;
+    tw->count++;
+
+    tw_rearm(tw);
+}
+
+void tw_timer_stop(struct tw_timer *t)
+{
+    struct twheel *tw = t->tw;
+
+    if (!t->active)
+        return;
+
+    tw_del(tw, t);
+    t->active = false;
+    tw->count--;
+
+    tw_rearm(tw);
+}
+
+struct twheel *twheel_get(struct ev_loop *loop)
+{
+    struct list_head *p, *n;
+    struct twheel *tw;
+    int i, j;
+
+    pthread_mutex_lock(&twheel_lock);
+
+    list_for_each_safe(p, n, &twheels) {
+        tw = list_entry(p, struct twheel, node);
+        if (tw->loop == loop) {
+            tw->refs++;
+            goto out;
+        }
+    }
+
+    tw = calloc(1, sizeof(struct twheel));
+    if (!tw)
+        goto out;
+
+    for (i = 0; i < TW_LEVELS; i++) {
+        for (j = 0; j < TW_SLOTS; j++)
+            INIT_LIST_HEAD(&tw->slots[i][j]);
+    }
+
+    tw->loop = loop;
+    tw->refs = 1;
+    tw->base = ev_now(loop);
+    ev_timer_init(&tw->timer, tw_timer_cb, 0.0, 0.0);
+    list_add(&tw->node, &twheels);
+
+out:
+    pthread_mutex_unlock(&twheel_lock);
+    return tw;
+}
+
+void twheel_put(struct twheel *tw)
+{
+    pthread_mutex_lock(&twheel_lock);
+
+    if (--tw->refs == 0) {
+        ev_timer_stop(tw->loop, &tw->timer);
+        list_del_init(&tw->node);
+        free(tw);
+    }
+
+    pthread_mutex_unlock(&twheel_lock);
+}
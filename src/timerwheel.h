@@ -0,0 +1,72 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _TIMERWHEEL_H
+#define _TIMERWHEEL_H
+
+#include <ev.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "list.h"
+
+#define TW_TICK     0.01    /* Seconds */
+#define TW_BITS     6
+#define TW_SLOTS    (1 << TW_BITS)
+#define TW_LEVELS   4       /* Covers 2^24 ticks, about 46 hours */
+
+/*
+ * Hierarchical timer wheel, one per loop, driven by a single ev_timer that
+ * is only armed for the next expiry. Starting and stopping a timer is O(1),
+ * the next expiry is found from per level occupancy bitmaps.
+ */
+struct twheel;
+
+struct tw_timer {
+    struct list_head list;
+    struct twheel *tw;
+    uint64_t expires;       /* In ticks */
+    uint8_t level;
+    uint8_t slot;
+    bool active;
+    void (*cb)(struct tw_timer *t);
+};
+
+/* Return the wheel of @loop, creating it on first use. Must be called from the loop's thread */
+struct twheel *twheel_get(struct ev_loop *loop);
+void twheel_put(struct twheel *tw);
+
+static inline void tw_timer_init(struct tw_timer *t, struct twheel *tw, void (*cb)(struct tw_timer *t))
+{
+    INIT_LIST_HEAD(&t->list);
+    t->tw = tw;
+    t->active = false;
+    t->cb = cb;
+}
+
+/* (Re)start @t to fire once after @after seconds, ignored if @t has no wheel */
+void tw_timer_start(struct tw_timer *t, double after);
+void tw_timer_stop(struct tw_timer *t);
+
+#endif
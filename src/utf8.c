@@ -0,0 +1,267 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "utf8.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || __GNUC__ >= 5)
+#define UTF8_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+/*
+ * Björn Höhrmann's DFA, http://bjoern.hoehrmann.de/utf-8/decoder/dfa/
+ * The first 256 entries map a byte to its class, the rest map a state
+ * plus a class to the next state. States are multiples of 12.
+ */
+static const uint8_t utf8_dfa[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    8, 8, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    10, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 4, 3, 3, 11, 6, 6, 6, 5, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+
+    0, 12, 24, 36, 60, 96, 84, 12, 12, 12, 48, 72, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 0, 12, 12, 12, 12, 12, 0, 12, 0, 12, 12, 12, 24, 12, 12, 12, 12, 12, 24, 12, 24, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 24, 12, 12, 12, 12, 12, 24, 12, 12, 12, 12, 12, 12, 12, 24, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 36, 12, 36, 12, 12, 12, 36, 12, 12, 12, 12, 12, 36, 12, 36, 12, 12,
+    12, 36, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12
+};
+
+/*
+ * Validate from a character boundary in large steps. Return how far the
+ * text is known to be valid, which is short of the end if it ends in the
+ * middle of a sequence, or SIZE_MAX if it's invalid.
+ */
+typedef size_t (*utf8_blocks_t)(const uint8_t *p, size_t len);
+
+/* Skip ASCII a word at a time */
+static size_t utf8_blocks_generic(const uint8_t *p, size_t len)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v;
+
+        memcpy(&v, p + i, 8);
+        if (v & 0x8080808080808080ULL)
+            break;
+    }
+
+    return i;
+}
+
+#ifdef UTF8_X86
+#define UTF8_TOO_SHORT      (1 << 0)    /* 11______ 0_______ or 11______ 11______ */
+#define UTF8_TOO_LONG       (1 << 1)    /* 0_______ 10______ */
+#define UTF8_OVERLONG_3     (1 << 2)    /* 11100000 100_____ */
+#define UTF8_TOO_LARGE      (1 << 3)    /* 11110100 1001____ and above */
+#define UTF8_SURROGATE      (1 << 4)    /* 11101101 101_____ */
+#define UTF8_OVERLONG_2     (1 << 5)    /* 1100000_ 10______ */
+#define UTF8_TOO_LARGE_1000 (1 << 6)    /* 11110101 1000____ and above */
+#define UTF8_OVERLONG_4     (1 << 6)    /* 11110000 1000____ */
+#define UTF8_TWO_CONTS      (1 << 7)    /* 10______ 10______ */
+#define UTF8_CARRY          (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+__attribute__((target("ssse3")))
+static inline __m128i utf8_hi_nibbles(__m128i v)
+{
+    return _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0f));
+}
+
+/*
+ * The lookup algorithm of John Keiser and Daniel Lemire, "Validating UTF-8
+ * In Less Than One Instruction Per Byte", 2021. Every byte pair is checked
+ * against three nibble tables, what's left is whether the third and fourth
+ * bytes of long sequences are continuations.
+ */
+__attribute__((target("ssse3")))
+static inline __m128i utf8_check_block(__m128i in, __m128i prev)
+{
+    const __m128i byte_1_high_tbl = _mm_setr_epi8(
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        (char)UTF8_TWO_CONTS, (char)UTF8_TWO_CONTS, (char)UTF8_TWO_CONTS, (char)UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4);
+    const __m128i byte_1_low_tbl = _mm_setr_epi8(
+        (char)(UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4),
+        (char)(UTF8_CARRY | UTF8_OVERLONG_2),
+        (char)UTF8_CARRY,
+        (char)UTF8_CARRY,
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000));
+    const __m128i byte_2_high_tbl = _mm_setr_epi8(
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+            UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4),
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE),
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT);
+    __m128i prev1 = _mm_alignr_epi8(in, prev, 15);
+    __m128i prev2 = _mm_alignr_epi8(in, prev, 14);
+    __m128i prev3 = _mm_alignr_epi8(in, prev, 13);
+    __m128i sc, must23;
+
+    sc = _mm_and_si128(_mm_shuffle_epi8(byte_1_high_tbl, utf8_hi_nibbles(prev1)),
+        _mm_shuffle_epi8(byte_1_low_tbl, _mm_and_si128(prev1, _mm_set1_epi8(0x0f))));
+    sc = _mm_and_si128(sc, _mm_shuffle_epi8(byte_2_high_tbl, utf8_hi_nibbles(in)));
+
+    /* Only 111_____ two back and 1111____ three back come out >= 0x80 */
+    must23 = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8(0xe0 - 0x80)),
+        _mm_subs_epu8(prev3, _mm_set1_epi8(0xf0 - 0x80)));
+    must23 = _mm_and_si128(must23, _mm_set1_epi8((char)0x80));
+
+    return _mm_xor_si128(must23, sc);
+}
+
+__attribute__((target("ssse3")))
+static size_t utf8_blocks_ssse3(const uint8_t *p, size_t len)
+{
+    /* A lead byte this close to the end of a block needs the next one */
+    const __m128i max_value = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, (char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1));
+    __m128i prev = _mm_setzero_si128();
+    __m128i prev_incomplete = _mm_setzero_si128();
+    __m128i err = _mm_setzero_si128();
+    size_t n = len & ~(size_t)15;
+    size_t i, k;
+
+    for (i = 0; i < n; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(p + i));
+
+        if (!_mm_movemask_epi8(in)) {
+            err = _mm_or_si128(err, prev_incomplete);
+            prev_incomplete = _mm_setzero_si128();
+        } else {
+            err = _mm_or_si128(err, utf8_check_block(in, prev));
+            prev_incomplete = _mm_subs_epu8(in, max_value);
+        }
+
+        prev = in;
+    }
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(err, _mm_setzero_si128())) != 0xffff)
+        return SIZE_MAX;
+
+    /* Leave a sequence cut by the end to the DFA */
+    for (k = 1; k <= 3 && k <= n; k++) {
+        uint8_t c = p[n - k];
+
+        if (c >= 0xc0) {
+            if (k < (c >= 0xf0 ? 4U : c >= 0xe0 ? 3U : 2U))
+                n -= k;
+            break;
+        }
+
+        if (c < 0x80)
+            break;
+    }
+
+    return n;
+}
+
+static bool utf8_has_ssse3(void)
+{
+    unsigned int a, b, c, d;
+
+    return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSSE3);
+}
+#endif
+
+static size_t utf8_blocks_resolve(const uint8_t *p, size_t len);
+
+/* Resolved to the best implementation for this CPU on first use */
+static utf8_blocks_t utf8_blocks_impl = utf8_blocks_resolve;
+
+static size_t utf8_blocks_resolve(const uint8_t *p, size_t len)
+{
+    utf8_blocks_t impl = utf8_blocks_generic;
+
+#ifdef UTF8_X86
+    if (utf8_has_ssse3())
+        impl = utf8_blocks_ssse3;
+#endif
+
+    __atomic_store_n(&utf8_blocks_impl, impl, __ATOMIC_RELAXED);
+    return impl(p, len);
+}
+
+uint32_t utf8_validate(uint32_t state, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    size_t stop;
+
+    while (len > 0) {
+        if (state == UTF8_ACCEPT && len >= 16) {
+            size_t n = __atomic_load_n(&utf8_blocks_impl, __ATOMIC_RELAXED)(p, len);
+
+            if (n == SIZE_MAX)
+                return UTF8_REJECT;
+
+            p += n;
+            len -= n;
+        }
+
+        /*
+         * The block routine stopped at non-ASCII or a cut sequence. Go on
+         * for at least 16 bytes to the next character boundary, so that
+         * text with few ASCII runs doesn't bounce between the two.
+         */
+        stop = len > 16 ? len - 16 : 0;
+
+        while (len > 0) {
+            state = utf8_dfa[256 + state + utf8_dfa[*p++]];
+            len--;
+
+            if (state == UTF8_REJECT)
+                return state;
+
+            if (len <= stop && state == UTF8_ACCEPT)
+                break;
+        }
+    }
+
+    return state;
+}
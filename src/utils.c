@@ -27,26 +27,21 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
-#include <netdb.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 
 #include "log.h"
 #include "utils.h"
+#include "csprng.h"
 
 int get_nonce(uint8_t *dest, int len)
 {
-    FILE *fp;
-    size_t n;
-
-    fp = fopen("/dev/urandom", "r");
-    if (fp) {
-        n = fread(dest, len, 1, fp);
-        fclose(fp);
-        return n;
+    if (csprng_bytes(dest, len) < 0) {
+        log_err("Failed to seed the random generator\n");
+        return -1;
     }
 
-    return -1;
+    return len;
 }
 
 int parse_url(const char *url, char *host, int host_len,
@@ -73,9 +68,22 @@ int parse_url(const char *url, char *host, int host_len,
 
     host_pos = url;
 
+    /* IPv6 literal, e.g. ws://[::1]:8080/ */
+    if (*url == '[') {
+        p = strchr(url, ']');
+        if (!p)
+            return -1;
+        host_pos = url + 1;
+        hl = p - host_pos;
+        url = p + 1;
+        if (*url != ':' && *url != '/' && *url)
+            return -1;
+    }
+
     p = strchr(url, ':');
-    if (p) {
-        hl = p - url;
+    if (p && p < strchrnul(url, '/')) {
+        if (hl == 0)
+            hl = p - url;
         url = p + 1;
         *port = atoi(url);
     }
@@ -98,110 +106,26 @@ int parse_url(const char *url, char *host, int host_len,
     return 0;
 }
 
-static const char *port2str(int port)
-{
-    static char buffer[sizeof("65535\0")];
-
-    if (port < 0 || port > 65535)
-        return NULL;
-
-    snprintf(buffer, sizeof(buffer), "%u", port);
-
-    return buffer;
-}
-
-int tcp_connect(const char *host, int port, int flags, bool *inprogress, int *eai)
+int tcp_connect_addr(const struct sockaddr *addr, socklen_t addrlen, int flags, bool *inprogress)
 {
-    int ret;
-    int sock = -1;
-    int addr_len;
-    struct sockaddr *addr = NULL;
-    struct addrinfo *result, *rp;
-    struct addrinfo hints = {
-        .ai_family = AF_INET,
-        .ai_socktype = SOCK_STREAM,
-        .ai_flags = AI_ADDRCONFIG
-    };
+    int sock;
 
     *inprogress = false;
 
-    ret = getaddrinfo(host, port2str(port), &hints, &result);
-    if (ret) {
-        if (ret == EAI_SYSTEM)
-            return -1;
-        *eai =  ret;
-        return 0;
-    }
-
-    for (rp = result; rp != NULL; rp = rp->ai_next) {
-        if (rp->ai_family == AF_INET) {
-            addr = rp->ai_addr;
-            addr_len = rp->ai_addrlen;
-            break;
-        }
-    }
-
-    if (!addr)
-        goto free_addrinfo;
-
-    sock = socket(AF_INET, SOCK_STREAM | flags, 0);
+    sock = socket(addr->sa_family, SOCK_STREAM | flags, 0);
     if (sock < 0)
-        goto free_addrinfo;
+        return -1;
 
-    if (connect(sock, addr, addr_len) < 0) {
+    if (connect(sock, addr, addrlen) < 0) {
         if (errno != EINPROGRESS) {
-            close(sock);
-            sock = -1;
-        } else {
-            *inprogress = true;
-        }
-    }
+            int err = errno;
 
-free_addrinfo:
-    freeaddrinfo(result);
-    return sock;
-}
-
-/* reference from https://tools.ietf.org/html/rfc4648#section-4 */
-int b64_encode(const void *src, size_t srclen, void *dest, size_t destsize)
-{
-    char *Base64 =
-        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/=";
-    const uint8_t *input = src;
-    char *output = dest;
-
-    while (srclen > 0) {
-        int skip = 1;
-        int i0 = input[0] >> 2;
-        int i1 = (input[0] & 0x3) << 4;
-        int i2 = 64;
-        int i3 = 64;
-
-        if (destsize < 5)
+            close(sock);
+            errno = err;
             return -1;
-
-        if (srclen > 1) {
-            skip++;
-            i1 += input[1] >> 4;
-            i2 = (input[1] & 0xF) << 2;
-
-            if (srclen > 2) {
-                i2 += input[2] >> 6;
-                i3 = input[2] & 0x3F;
-                skip++;
-            }
         }
-
-        *output++ = Base64[i0];
-        *output++ = Base64[i1];
-        *output++ = Base64[i2];
-        *output++ = Base64[i3];
-
-        input += skip;
-        srclen -= skip;
-        destsize -= 4;
+        *inprogress = true;
     }
 
-    *output++ = 0;
-    return output - (char *)dest - 1;
+    return sock;
 }
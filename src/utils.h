@@ -28,6 +28,9 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <sys/socket.h>
+
+#include "base64.h"
 
 #ifndef container_of
 #define container_of(ptr, type, member)                 \
@@ -41,8 +44,7 @@ int get_nonce(uint8_t *dest, int len);
 int parse_url(const char *url, char *host, int host_len,
     int *port, const char **path, bool *ssl);
 
-int tcp_connect(const char *host, int port, int flags, bool *inprogress, int *eai);
-
-int b64_encode(const void *src, size_t srclen, void *dest, size_t destsize);
+/* Start a connect to @addr, return the socket or -1 with errno set */
+int tcp_connect_addr(const struct sockaddr *addr, socklen_t addrlen, int flags, bool *inprogress);
 
 #endif
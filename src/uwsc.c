@@ -30,168 +30,944 @@
 #include <time.h>
 #include <netdb.h>
 #include <limits.h>
+#include <stdint.h>
 
 #include "uwsc.h"
-#include "sha1.h"
+#include "mask.h"
 #include "utils.h"
+#include "connect.h"
+#include "pool.h"
+#include "stats.h"
 
 #ifdef SSL_SUPPORT
 #include "ssl/ssl.h"
+#include "sslcache.h"
+#endif
+
+#ifdef DEFLATE_SUPPORT
+#include "pmdeflate.h"
 #endif
 
 #ifdef SSL_SUPPORT
 static struct ssl_context *ssl_ctx;
 #endif
 
-static void uwsc_free(struct uwsc_client *cl)
+/* A pooled client takes the storage of an empty buffer from its pool */
+static inline void uwsc_buffer_prep(struct uwsc_client *cl, struct buffer *b, size_t len)
+{
+    if (cl->pool && !buffer_size(b))
+        pool_buffer_get(cl->pool, b, len);
+}
+
+static inline void uwsc_buffer_release(struct uwsc_client *cl, struct buffer *b)
+{
+    if (cl->pool)
+        pool_buffer_put(cl->pool, b);
+    else
+        buffer_free(b);
+}
+
+/*
+ * After a while without data frames the buffers that are empty go back to
+ * the pool (or the heap), so that a quiet connection holds little more than
+ * its struct. They are allocated again by the next read or write.
+ */
+static void uwsc_idle_cb(struct tw_timer *t)
 {
-    ev_timer_stop(cl->loop, &cl->timer);
+    struct uwsc_client *cl = container_of(t, struct uwsc_client, idle_timer);
+    ev_tstamp idle = ev_now(cl->loop) - cl->last_active;
+    bool busy = false;
+
+    if (idle < cl->idle_release) {
+        tw_timer_start(t, cl->idle_release - idle);
+        return;
+    }
+
+    if (buffer_length(&cl->rb) == 0)
+        uwsc_buffer_release(cl, &cl->rb);
+    else
+        busy = true;
+
+    if (buffer_length(&cl->wb) == 0)
+        uwsc_buffer_release(cl, &cl->wb);
+    else
+        busy = true;
+
+    if (buffer_length(&cl->cwb) == 0)
+        uwsc_buffer_release(cl, &cl->cwb);
+    else
+        busy = true;
+
+#ifdef DEFLATE_SUPPORT
+    /* Scratch space, empty between messages */
+    if (cl->pmd) {
+        if (buffer_length(&cl->pmd->ob) == 0)
+            uwsc_buffer_release(cl, &cl->pmd->ob);
+        if (buffer_length(&cl->pmd->ib) == 0)
+            uwsc_buffer_release(cl, &cl->pmd->ib);
+    }
+#endif
+
+    /* Still draining or a message half received, look again later */
+    if (busy)
+        tw_timer_start(t, cl->idle_release);
+}
+
+/* A data frame went in or out */
+static inline void uwsc_touch(struct uwsc_client *cl)
+{
+    cl->last_active = ev_now(cl->loop);
+
+    if (cl->idle_release > 0 && !cl->idle_timer.active)
+        tw_timer_start(&cl->idle_timer, cl->idle_release);
+}
+
+/* Tear down the connection, what the client was set up with stays */
+static void uwsc_disconnect(struct uwsc_client *cl)
+{
+    tw_timer_stop(&cl->timer);
+    tw_timer_stop(&cl->idle_timer);
     ev_io_stop(cl->loop, &cl->ior);
     ev_io_stop(cl->loop, &cl->iow);
-    buffer_free(&cl->rb);
-    buffer_free(&cl->wb);
 
-#ifdef SSL_SUPPORT
-    ssl_session_free(cl->ssl);
-#endif
+    if (cl->conn) {
+        connector_cancel(cl->conn);
+        free(cl->conn);
+        cl->conn = NULL;
+    }
+
+    free(cl->handshake);
+    cl->handshake = NULL;
+
+    uwsc_buffer_release(cl, &cl->rb);
+    uwsc_buffer_release(cl, &cl->cwb);
+
+#ifdef SSL_SUPPORT
+    if (cl->ssl) {
+        /* Tickets may have come after the handshake */
+        if (cl->state > CLIENT_STATE_SSL_HANDSHAKE)
+            sslcache_save(cl->ssl, cl->host, cl->port);
+        ssl_session_free(cl->ssl);
+    }
+#endif
+    cl->ssl = NULL;
+
+    if (cl->sock > 0)
+        close(cl->sock);
+    cl->sock = -1;
+}
+
+static void uwsc_default_free(struct uwsc_client *cl)
+{
+    tw_timer_stop(&cl->retry_timer);
+
+    uwsc_disconnect(cl);
+
+    stats_unregister(cl);
+
+    if (cl->timer.tw) {
+        twheel_put(cl->timer.tw);
+        cl->timer.tw = cl->retry_timer.tw = cl->idle_timer.tw = NULL;
+    }
+
+    uwsc_buffer_release(cl, &cl->wb);
+
+    hs_template_put(cl->hs);
+    cl->hs = NULL;
+
+#ifdef DEFLATE_SUPPORT
+    pmd_free(cl->pmd);
+    cl->pmd = NULL;
+#endif
+
+    free(cl->host);
+    free(cl->path);
+    free(cl->extra_header);
+    cl->host = cl->path = cl->extra_header = NULL;
+}
+
+static bool uwsc_reconnect(struct uwsc_client *cl, const char *reason);
+
+static inline void uwsc_error(struct uwsc_client *cl, int err, const char *msg)
+{
+    if (!msg)
+        msg = "";
+
+    if (uwsc_reconnect(cl, msg))
+        return;
+
+    uwsc_default_free(cl);
+
+    if (cl->onerror)
+        cl->onerror(cl, err, msg);
+}
+
+/* Data queued before the connection is made goes out after the handshake */
+static inline void uwsc_want_write(struct uwsc_client *cl)
+{
+    if (cl->sock >= 0)
+        ev_io_start(cl->loop, &cl->iow);
+}
+
+/* Return the bytes written, 0 if the socket is full or -1 on error */
+static int uwsc_write(struct uwsc_client *cl, const void *data, size_t len, const char **err)
+{
+    int ret = 0;
+
+    if (cl->ssl) {
+#ifdef SSL_SUPPORT
+        static char err_buf[128];
+
+        ret = ssl_write(cl->ssl, data, len);
+        if (ret == SSL_ERROR) {
+            log_err("ssl_write(%d): %s\n", ssl_err_code,
+                    ssl_strerror(ssl_err_code, err_buf, sizeof(err_buf)));
+            *err = err_buf;
+            return -1;
+        }
+
+        if (ret == SSL_PENDING)
+            ret = 0;
+#endif
+    } else {
+        ret = write(cl->sock, data, len);
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EINTR)
+                ret = 0;
+            else {
+                *err = "write error";
+                return -1;
+            }
+        }
+    }
+
+    stats_add(cl, writes, 1);
+    stats_add(cl, bytes_written, ret);
+    if ((size_t)ret < len)
+        stats_add(cl, partial_writes, 1);
+
+    return ret;
+}
+
+/* Total size of the frame we queued at @p */
+static size_t uwsc_frame_size(const uint8_t *p)
+{
+    uint64_t len = p[1] & 0x7F;
+    size_t hlen = 2 + 4;
+    int i;
+
+    if (len == 126) {
+        len = (p[2] << 8) | p[3];
+        hlen += 2;
+    } else if (len == 127) {
+        len = 0;
+        for (i = 0; i < 8; i++)
+            len = (len << 8) | p[2 + i];
+        hlen += 8;
+    }
+
+    return hlen + len;
+}
+
+/* Account for @n bytes written from the head of wb */
+static void uwsc_wb_advance(struct uwsc_client *cl, size_t n)
+{
+    const uint8_t *p = buffer_data(&cl->wb);
+
+    while (n > 0) {
+        size_t step;
+
+        if (cl->wb_frame_left == 0)
+            cl->wb_frame_left = uwsc_frame_size(p);
+
+        step = n < cl->wb_frame_left ? n : cl->wb_frame_left;
+        cl->wb_frame_left -= step;
+        p += step;
+        n -= step;
+    }
+}
+
+/*
+ * Keep the data messages queued in wb for the next connection. Dropped are
+ * the rest of a partly written frame (or the handshake request), fragments
+ * whose first frame is gone, a message that is not complete yet, messages
+ * compressed with the old connection's context and control frames.
+ */
+static void uwsc_wb_salvage(struct uwsc_client *cl)
+{
+    struct buffer kept = {};
+    const uint8_t *p, *end;
+    bool open = false;      /* The last message kept has no FIN frame yet */
+    bool keep = false;
+    size_t start = 0;
+
+    buffer_pull(&cl->wb, NULL, cl->wb_frame_left);
+    cl->wb_frame_left = 0;
+
+    p = buffer_data(&cl->wb);
+    end = p + buffer_length(&cl->wb);
+
+    while (p < end) {
+        size_t size = uwsc_frame_size(p);
+        int op = p[0] & 0x0F;
+
+        if (op & 0x08) {
+            p += size;
+            continue;
+        }
+
+        if (op != UWSC_OP_CONTINUE) {
+            keep = !(p[0] & 0x40);
+            start = buffer_length(&kept);
+        } else if (!open) {
+            keep = false;
+        }
+
+        if (keep && buffer_put_data(&kept, p, size) < 0) {
+            log_err("buffer_put failed\n");
+            buffer_truncate(&kept, start);
+            open = false;
+            break;
+        }
+
+        open = !(p[0] & 0x80);
+        p += size;
+    }
+
+    if (open && keep)
+        buffer_truncate(&kept, start);
+
+    uwsc_buffer_release(cl, &cl->wb);
+    cl->wb = kept;
+}
+
+/* Next ping one interval after the last one, nothing to do when pings are off */
+static void uwsc_schedule_ping(struct uwsc_client *cl)
+{
+    if (cl->ping_interval < 1) {
+        tw_timer_stop(&cl->timer);
+        return;
+    }
+
+    tw_timer_start(&cl->timer, cl->last_ping + cl->ping_interval - ev_now(cl->loop));
+}
+
+static void uwsc_retry_cb(struct tw_timer *t);
+
+/*
+ * Schedule a new connection if a reconnect policy is set and has attempts
+ * left, with a full jitter exponential backoff: a random delay between 0
+ * and min(max_delay, base_delay * 2^n).
+ */
+static bool uwsc_reconnect(struct uwsc_client *cl, const char *reason)
+{
+    struct uwsc_reconnect *rc = &cl->reconnect;
+    uint32_t rnd = 0;
+    double delay;
+
+    if (rc->base_delay <= 0 || cl->closing)
+        return false;
+
+    if (rc->max_attempts && cl->retries >= rc->max_attempts)
+        return false;
+
+    delay = rc->base_delay * (1ULL << (cl->retries < 32 ? cl->retries : 32));
+    if (delay > rc->max_delay)
+        delay = rc->max_delay;
+
+    get_nonce((uint8_t *)&rnd, sizeof(rnd));
+    delay = delay * rnd / UINT32_MAX;
+
+    cl->retries++;
+    stats_add(cl, reconnects, 1);
+
+    log_info("%s, reconnect in %.3fs (attempt %d)\n", reason, delay, cl->retries);
+
+    if (rc->keep_queued)
+        uwsc_wb_salvage(cl);
+    else
+        uwsc_buffer_release(cl, &cl->wb);
+
+    uwsc_disconnect(cl);
+
+#ifdef DEFLATE_SUPPORT
+    if (cl->pmd)
+        pmd_reset(cl->pmd);
+#endif
+
+    cl->state = CLIENT_STATE_CONNECTING;
+    cl->wb_frame_left = 0;
+    memset(&cl->frame, 0, sizeof(cl->frame));
+    memset(&cl->msg, 0, sizeof(cl->msg));
+    cl->wait_pong = false;
+    cl->ntimeout = 0;
+    cl->ping_sent = 0;
+    memset(&cl->rtt, 0, sizeof(cl->rtt));
+    cl->parse_pending = false;
+    cl->wb_blocked = cl->wb_high && buffer_length(&cl->wb) >= cl->wb_high;
+
+    /* A message being sent in pieces can't be continued on a new connection */
+    cl->tx_op = 0;
+    cl->tx_deflate = false;
+    cl->producer = NULL;
+
+    tw_timer_start(&cl->retry_timer, delay);
+
+    if (cl->onreconnect)
+        cl->onreconnect(cl, cl->retries, delay, reason);
+
+    return true;
+}
+
+/*
+ * Write as much as the socket accepts. Queued Ping and Pong frames go out at the
+ * next frame boundary in wb, ahead of the data frames still waiting there.
+ * Return -1 on error.
+ */
+static int uwsc_flush(struct uwsc_client *cl, const char **err)
+{
+    struct buffer *cwb = &cl->cwb;
+    struct buffer *wb = &cl->wb;
+    size_t len;
+    int ret;
+
+    while (1) {
+        if (cl->wb_frame_left == 0 && buffer_length(cwb) > 0) {
+            ret = uwsc_write(cl, buffer_data(cwb), buffer_length(cwb), err);
+            if (ret < 0)
+                return -1;
+
+            buffer_pull(cwb, NULL, ret);
+
+            /* Finish the control frames before anything else */
+            if (buffer_length(cwb) > 0)
+                return 0;
+        }
+
+        len = buffer_length(wb);
+        if (len == 0)
+            return 0;
+
+        /* Stop at the end of the current frame when control frames are waiting */
+        if (buffer_length(cwb) > 0 && cl->wb_frame_left < len)
+            len = cl->wb_frame_left;
+
+        ret = uwsc_write(cl, buffer_data(wb), len, err);
+        if (ret < 0)
+            return -1;
+
+        uwsc_wb_advance(cl, ret);
+        buffer_pull(wb, NULL, ret);
+
+        if (ret < len || buffer_length(cwb) == 0)
+            return 0;
+    }
+}
+
+static int uwsc_send_close_frame(struct uwsc_client *cl, int code, const char *reason)
+{
+    char buf[128] = "";
+
+    code = htobe16(code & 0xFFFF);
+    memcpy(buf, &code, 2);
+
+    if (reason)
+        strncpy(&buf[2], reason, sizeof(buf) - 3);
+
+    return cl->ops->send(cl, buf, strlen(buf + 2) + 2, UWSC_OP_CLOSE);
+}
+
+/* Close on purpose, neither the server's answer nor an error afterwards triggers a reconnect */
+static int uwsc_default_send_close(struct uwsc_client *cl, int code, const char *reason)
+{
+    cl->closing = true;
+    tw_timer_stop(&cl->retry_timer);
+
+    return uwsc_send_close_frame(cl, code, reason);
+}
+
+/* Fail the WebSocket connection: send a close frame with @code, then tear down */
+static void uwsc_fail(struct uwsc_client *cl, int err, int code, const char *msg)
+{
+    const char *werr;
+
+    log_err("%s\n", msg);
+
+    uwsc_send_close_frame(cl, code, msg);
+    uwsc_flush(cl, &werr);
+    uwsc_error(cl, err, msg);
+}
+
+/*
+ * A fragmented message is reassembled in place at the head of rb. Frame
+ * headers and interleaved control frames that were consumed after it are
+ * tracked as a gap, and each fragment payload is moved down over the gap.
+ * Unparsed data starts after the message and the gap.
+ */
+static inline uint8_t *rb_cursor(struct uwsc_client *cl)
+{
+    return (uint8_t *)buffer_data(&cl->rb) + cl->msg.len + cl->msg.gap;
+}
+
+static inline size_t rb_unparsed(struct uwsc_client *cl)
+{
+    return buffer_length(&cl->rb) - cl->msg.len - cl->msg.gap;
+}
+
+static inline void rb_consume(struct uwsc_client *cl, size_t n)
+{
+    if (cl->msg.len == 0)
+        buffer_pull(&cl->rb, NULL, n);
+    else
+        cl->msg.gap += n;
+}
+
+static inline bool uwsc_deflate_negotiated(struct uwsc_client *cl)
+{
+#ifdef DEFLATE_SUPPORT
+    return cl->pmd && cl->pmd->negotiated;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Carry the validation of a text message over the next piece of it.
+ * At the end of the message a cut sequence is invalid too.
+ */
+static inline bool uwsc_utf8_valid(struct uwsc_client *cl, const void *data, size_t len, bool fin)
+{
+    if (cl->msg.opcode != UWSC_OP_TEXT || cl->skip_utf8_check)
+        return true;
+
+    cl->msg.utf8 = utf8_validate(cl->msg.utf8, data, len);
+
+    return cl->msg.utf8 != UTF8_REJECT && (!fin || cl->msg.utf8 == UTF8_ACCEPT);
+}
+
+/* Data frames are handed to onmessage_chunk as they arrive instead of being buffered */
+static inline bool uwsc_streaming(struct uwsc_client *cl, struct uwsc_frame *frame)
+{
+    return cl->onmessage_chunk && !(frame->opcode & 0x08);
+}
+
+static bool parse_header(struct uwsc_client *cl)
+{
+    struct uwsc_frame *frame = &cl->frame;
+    uint8_t head, len;
+    uint8_t *p;
+
+    if (rb_unparsed(cl) < 2)
+        return false;
+
+    p = rb_cursor(cl);
+    head = p[0];
+    len = p[1];
+
+    frame->fin = (head & 0x80) ? true : false;
+    frame->opcode = head & 0x0F;
+
+    /* RSV1 marks a compressed message and is only valid on its first frame */
+    if ((head & 0x30) || ((head & 0x40) && !uwsc_deflate_negotiated(cl))) {
+        uwsc_fail(cl, UWSC_ERROR_PROTOCOL, UWSC_CLOSE_STATUS_PROTOCOL_ERR, "Reserved bits set");
+        return false;
+    }
+
+    if ((head & 0x40) && (frame->opcode & 0x08 || frame->opcode == UWSC_OP_CONTINUE)) {
+        uwsc_fail(cl, UWSC_ERROR_PROTOCOL, UWSC_CLOSE_STATUS_PROTOCOL_ERR, "RSV1 set on a non-first frame");
+        return false;
+    }
+
+    if (frame->opcode == UWSC_OP_TEXT || frame->opcode == UWSC_OP_BINARY)
+        cl->msg.compressed = (head & 0x40) ? true : false;
+
+    if (len & 0x80) {
+        uwsc_error(cl, UWSC_ERROR_SERVER_MASKED, "Masked error");
+        return false;
+    }
+
+    frame->payloadlen = len & 0x7F;
+
+    if (frame->opcode & 0x08) {
+        if (!frame->fin || frame->payloadlen > 125) {
+            uwsc_fail(cl, UWSC_ERROR_PROTOCOL, UWSC_CLOSE_STATUS_PROTOCOL_ERR,
+                "Fragmented or oversized control frame");
+            return false;
+        }
+    } else if (frame->opcode == UWSC_OP_CONTINUE) {
+        if (!cl->msg.opcode) {
+            uwsc_fail(cl, UWSC_ERROR_PROTOCOL, UWSC_CLOSE_STATUS_PROTOCOL_ERR,
+                "Unexpected continuation frame");
+            return false;
+        }
+    } else if (cl->msg.opcode) {
+        uwsc_fail(cl, UWSC_ERROR_PROTOCOL, UWSC_CLOSE_STATUS_PROTOCOL_ERR,
+            "Expected continuation frame");
+        return false;
+    }
+
+    rb_consume(cl, 2);
+
+    cl->state = CLIENT_STATE_PARSE_MSG_PAYLEN;
+    return true;
+}
+
+static bool parse_paylen(struct uwsc_client *cl)
+{
+    struct uwsc_frame *frame = &cl->frame;
+    uint64_t len = 0;
+    uint8_t *p = rb_cursor(cl);
+    int i;
+
+    switch (frame->payloadlen) {
+    case 126:
+        if (rb_unparsed(cl) < 2)
+            return false;
+        frame->payloadlen = (p[0] << 8) | p[1];
+        rb_consume(cl, 2);
+        break;
+    case 127:
+        if (rb_unparsed(cl) < 8)
+            return false;
+        for (i = 0; i < 8; i++)
+            len = (len << 8) | p[i];
+        if (len >> 63 || (!uwsc_streaming(cl, frame) && len > SIZE_MAX - buffer_length(&cl->rb))) {
+            uwsc_fail(cl, UWSC_ERROR_TOO_LARGE, UWSC_CLOSE_STATUS_MESSAGE_TOO_LARGE, "Payload too large");
+            return false;
+        }
+        frame->payloadlen = len;
+        rb_consume(cl, 8);
+        break;
+    default:
+        break;
+    }
+
+    if (uwsc_streaming(cl, frame)) {
+        if (frame->opcode != UWSC_OP_CONTINUE) {
+            cl->msg.opcode = frame->opcode;
+            cl->msg.offset = 0;
+
+            if (cl->onmessage_begin)
+                cl->onmessage_begin(cl, frame->opcode, frame->fin && !cl->msg.compressed ?
+                    frame->payloadlen : UWSC_MSG_LEN_UNKNOWN);
+        }
+    } else if (!(frame->opcode & 0x08) && cl->max_message_size > 0 &&
+        frame->payloadlen > cl->max_message_size - cl->msg.len) {
+        uwsc_fail(cl, UWSC_ERROR_TOO_LARGE, UWSC_CLOSE_STATUS_MESSAGE_TOO_LARGE, "Message too large");
+        return false;
+    }
+
+    stats_frame_in(cl, frame->opcode, frame->payloadlen);
+
+    cl->state = CLIENT_STATE_PARSE_MSG_PAYLOAD;
+
+    return true;
+}
+
+static double uwsc_mono_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Ping payload: sequence number and send time in microseconds, big endian */
+#define UWSC_PING_LEN   12
+
+static void uwsc_ping_payload(uint8_t *p, uint32_t seq, double sent)
+{
+    uint64_t us = sent * 1e6;
+
+    seq = htobe32(seq);
+    us = htobe64(us);
+    memcpy(p, &seq, 4);
+    memcpy(p + 4, &us, 8);
+}
+
+/* Take a sample if @payload answers our last ping, other pongs don't count */
+static void uwsc_pong_rtt(struct uwsc_client *cl, const uint8_t *payload, uint64_t len)
+{
+    struct uwsc_rtt *rtt = &cl->rtt;
+    uint8_t expect[UWSC_PING_LEN];
+    double sample, dev;
+
+    if (len != UWSC_PING_LEN || !cl->ping_sent)
+        return;
+
+    uwsc_ping_payload(expect, cl->ping_seq, cl->ping_sent);
+    if (memcmp(payload, expect, UWSC_PING_LEN))
+        return;
+
+    sample = uwsc_mono_now() - cl->ping_sent;
+    cl->ping_sent = 0;
+
+    if (sample < 0)
+        sample = 0;
+
+    /* Smoothed like TCP's SRTT and RTTVAR, RFC 6298 */
+    if (rtt->samples++ == 0) {
+        rtt->avg = rtt->min = rtt->max = sample;
+        rtt->jitter = sample / 2;
+    } else {
+        dev = sample > rtt->avg ? sample - rtt->avg : rtt->avg - sample;
+        rtt->jitter += (dev - rtt->jitter) / 4;
+        rtt->avg += (sample - rtt->avg) / 8;
+        if (sample < rtt->min)
+            rtt->min = sample;
+        if (sample > rtt->max)
+            rtt->max = sample;
+    }
+
+    rtt->last = sample;
+
+    if (cl->onrtt)
+        cl->onrtt(cl, sample, rtt);
+}
+
+static bool dispach_control(struct uwsc_client *cl, uint8_t *payload)
+{
+    struct uwsc_frame *frame = &cl->frame;
+
+    switch (frame->opcode) {
+    case UWSC_OP_PING:
+        cl->ops->send(cl, payload, frame->payloadlen, UWSC_OP_PONG);
+        break;
+
+    case UWSC_OP_PONG:
+        cl->wait_pong = false;
+        cl->ntimeout = 0;
+        uwsc_pong_rtt(cl, payload, frame->payloadlen);
+        uwsc_schedule_ping(cl);
+        break;
+
+    case UWSC_OP_CLOSE: {
+        int code = UWSC_CLOSE_STATUS_NO_STATUS;
+        char reason[126] = "";
+
+        /* A status code takes two bytes, RFC 6455 section 5.5.1 */
+        if (frame->payloadlen == 1) {
+            uwsc_fail(cl, UWSC_ERROR_PROTOCOL, UWSC_CLOSE_STATUS_PROTOCOL_ERR, "Truncated close status");
+            return false;
+        }
+
+        if (frame->payloadlen >= 2) {
+            code = (payload[0] << 8) | payload[1];
+            memcpy(reason, payload + 2, frame->payloadlen - 2);
+
+            if (!cl->skip_utf8_check &&
+                utf8_validate(UTF8_ACCEPT, reason, frame->payloadlen - 2) != UTF8_ACCEPT) {
+                uwsc_fail(cl, UWSC_ERROR_PROTOCOL, UWSC_CLOSE_STATUS_INVALID_PAYLOAD, "Invalid UTF-8");
+                return false;
+            }
+        }
+
+        /* Closed by the server, e.g. going away for a restart */
+        if (uwsc_reconnect(cl, "closed by the server"))
+            return false;
+
+        uwsc_default_free(cl);
+
+        if (cl->onclose)
+            cl->onclose(cl, code, reason);
+        return false;
+    }
+
+    default:
+        uwsc_fail(cl, UWSC_ERROR_PROTOCOL, UWSC_CLOSE_STATUS_PROTOCOL_ERR, "unknown opcode");
+        return false;
+    }
+
+    rb_consume(cl, frame->payloadlen);
 
-    if (cl->sock > 0)
-        close(cl->sock);
+    return true;
 }
 
-static inline void uwsc_error(struct uwsc_client *cl, int err, const char *msg)
+static int uwsc_chunk_sink(void *arg, void *data, size_t len)
 {
-    uwsc_free(cl);
+    struct uwsc_client *cl = arg;
 
-    if (cl->onerror) {
-        if (!msg)
-            msg = "";
-        cl->onerror(cl, err, msg);
-    }
+    if (!uwsc_utf8_valid(cl, data, len, false))
+        return -3;
+
+    cl->onmessage_chunk(cl, data, len, cl->msg.offset);
+    cl->msg.offset += len;
+
+    return 0;
 }
 
-static int uwsc_send_close(struct uwsc_client *cl, int code, const char *reason)
+#ifdef DEFLATE_SUPPORT
+static int uwsc_inflate_sink(void *arg, void *data, size_t len)
 {
-    char buf[128] = "";
+    struct uwsc_client *cl = arg;
+    struct buffer *ib = &cl->pmd->ib;
 
-    code = htobe16(code & 0xFFFF);
-    memcpy(buf, &code, 2);
+    if (cl->max_message_size > 0 && len > cl->max_message_size - buffer_length(ib))
+        return -2;
 
-    if (reason)
-        strncpy(&buf[2], reason, sizeof(buf) - 3);
+    if (!uwsc_utf8_valid(cl, data, len, false))
+        return -3;
 
-    return cl->send(cl, buf, strlen(buf + 2) + 2, UWSC_OP_CLOSE);
+    return buffer_put_data(ib, data, len);
 }
 
-static bool parse_header(struct uwsc_client *cl)
+/* Feed a piece of a compressed message to @sink. Return false if the connection was failed */
+static bool uwsc_inflate(struct uwsc_client *cl, const void *data, size_t len, bool fin,
+    pmd_sink_t sink)
 {
-    struct uwsc_frame *frame = &cl->frame;
-    struct buffer *rb = &cl->rb;
-    uint8_t head, len;
-    bool fin;
+    int ret = pmd_decompress(cl->pmd, data, len, fin, sink, cl);
 
-    if (buffer_length(rb) < 2)
+    if (ret == -2) {
+        uwsc_fail(cl, UWSC_ERROR_TOO_LARGE, UWSC_CLOSE_STATUS_MESSAGE_TOO_LARGE, "Message too large");
         return false;
+    }
 
-    head = buffer_pull_u8(rb);
-
-    fin = (head & 0x80) ? true : false;
-    frame->opcode = head & 0x0F;
-
-    if (!fin || frame->opcode == UWSC_OP_CONTINUE) {
-        uwsc_error(cl, UWSC_ERROR_NOT_SUPPORT, "Not support fragment");
+    if (ret == -3) {
+        uwsc_fail(cl, UWSC_ERROR_PROTOCOL, UWSC_CLOSE_STATUS_INVALID_PAYLOAD, "Invalid UTF-8");
         return false;
     }
 
-    len = buffer_pull_u8(rb);
-    if (len & 0x80) {
-        uwsc_error(cl, UWSC_ERROR_SERVER_MASKED, "Masked error");
+    if (ret < 0) {
+        uwsc_fail(cl, UWSC_ERROR_PROTOCOL, UWSC_CLOSE_STATUS_INVALID_PAYLOAD, "Invalid compressed data");
         return false;
     }
 
-    frame->payloadlen = len & 0x7F;
-
-    cl->state = CLIENT_STATE_PARSE_MSG_PAYLEN;
     return true;
 }
+#endif
 
-static bool parse_paylen(struct uwsc_client *cl)
+static bool dispach_stream(struct uwsc_client *cl)
 {
     struct uwsc_frame *frame = &cl->frame;
     struct buffer *rb = &cl->rb;
-    uint64_t len;
+    size_t len = rb_unparsed(cl);
 
-    switch (frame->payloadlen) {
-    case 126:
-        if (buffer_length(rb) < 4)
-            return false;
-        frame->payloadlen = be16toh(buffer_pull_u16(rb));
-        break;
-    case 127:
-        if (buffer_length(rb) < 10)
+    if (len > frame->payloadlen)
+        len = frame->payloadlen;
+
+    if (len > 0) {
+#ifdef DEFLATE_SUPPORT
+        if (cl->msg.compressed) {
+            if (!uwsc_inflate(cl, rb_cursor(cl), len, false, uwsc_chunk_sink))
+                return false;
+        } else
+#endif
+        if (uwsc_chunk_sink(cl, rb_cursor(cl), len) < 0) {
+            uwsc_fail(cl, UWSC_ERROR_PROTOCOL, UWSC_CLOSE_STATUS_INVALID_PAYLOAD, "Invalid UTF-8");
             return false;
-        len = be64toh(buffer_pull_u64(rb));
-        if (len > ULONG_MAX) {
-            uwsc_error(cl, UWSC_ERROR_NOT_SUPPORT, "Payload too large");
-            uwsc_send_close(cl, UWSC_CLOSE_STATUS_MESSAGE_TOO_LARGE, "");
-        } else {
-            frame->payloadlen = len;
         }
-        break;
-    default:
-        break;
+
+        rb_consume(cl, len);
+        frame->payloadlen -= len;
     }
 
-    cl->state = CLIENT_STATE_PARSE_MSG_PAYLOAD;
+    /* Don't let a large message pin its peak size in rb */
+    if (buffer_length(rb) == 0 && buffer_size(rb) > UWSC_STREAM_RB_KEEP)
+        uwsc_buffer_release(cl, rb);
+
+    if (frame->payloadlen > 0)
+        return false;
+
+    cl->state = CLIENT_STATE_PARSE_MSG_HEAD;
+
+    if (frame->fin) {
+#ifdef DEFLATE_SUPPORT
+        if (cl->msg.compressed && !uwsc_inflate(cl, NULL, 0, true, uwsc_chunk_sink))
+            return false;
+#endif
+
+        if (!uwsc_utf8_valid(cl, NULL, 0, true)) {
+            uwsc_fail(cl, UWSC_ERROR_PROTOCOL, UWSC_CLOSE_STATUS_INVALID_PAYLOAD, "Invalid UTF-8");
+            return false;
+        }
+
+        if (cl->onmessage_end)
+            cl->onmessage_end(cl);
+        memset(&cl->msg, 0, sizeof(cl->msg));
+    }
 
     return true;
 }
 
+static void uwsc_deliver(struct uwsc_client *cl, void *data, size_t len)
+{
+    bool binary = cl->msg.opcode == UWSC_OP_BINARY;
+
+    if (cl->onmessage_ex) {
+        int flags = binary ? UWSC_MSG_BINARY : 0;
+
+        if (!binary && !cl->skip_utf8_check)
+            flags |= UWSC_MSG_UTF8_VALID;
+
+        cl->onmessage_ex(cl, data, len, flags);
+    } else if (cl->onmessage) {
+        cl->onmessage(cl, data, len, binary);
+    }
+}
+
 static bool dispach_message(struct uwsc_client *cl)
 {
-    struct buffer *rb = &cl->rb;
     struct uwsc_frame *frame = &cl->frame;
-    uint8_t *payload = buffer_data(rb);
+    struct buffer *rb = &cl->rb;
+    uint8_t *payload = rb_cursor(cl);
 
-    if (buffer_length(rb) < frame->payloadlen)
-        return false;
+    if (uwsc_streaming(cl, frame))
+        return dispach_stream(cl);
 
-    switch (frame->opcode) {
-    case UWSC_OP_TEXT:
-    case UWSC_OP_BINARY:
-        if (cl->onmessage)
-            cl->onmessage(cl, payload, frame->payloadlen, frame->opcode == UWSC_OP_BINARY);
-        break;
+    if (rb_unparsed(cl) < frame->payloadlen)
+        return false;
 
-    case UWSC_OP_PING:
-        cl->send(cl, payload, frame->payloadlen, UWSC_OP_PONG);
-        break;
+    cl->state = CLIENT_STATE_PARSE_MSG_HEAD;
 
-    case UWSC_OP_PONG:
-        cl->wait_pong = false;
-        break;
+    if (frame->opcode & 0x08)
+        return dispach_control(cl, payload);
 
-    case UWSC_OP_CLOSE:
-            if (cl->onclose) {
-                int code = buffer_pull_u16(&cl->rb);
-                char reason[128] = "";
+    if (frame->opcode != UWSC_OP_TEXT && frame->opcode != UWSC_OP_BINARY &&
+        frame->opcode != UWSC_OP_CONTINUE) {
+        uwsc_fail(cl, UWSC_ERROR_PROTOCOL, UWSC_CLOSE_STATUS_PROTOCOL_ERR, "unknown opcode");
+        return false;
+    }
 
-                frame->payloadlen -= 2;
-                buffer_pull(&cl->rb, reason, frame->payloadlen);
-                cl->onclose(cl, ntohs(code), reason);
-            }
+    /* Close the gap left by the headers in front of this fragment */
+    if (cl->msg.gap > 0)
+        memmove((uint8_t *)buffer_data(rb) + cl->msg.len, payload, frame->payloadlen);
 
-            uwsc_free(cl);
-        break;
+    if (frame->opcode != UWSC_OP_CONTINUE)
+        cl->msg.opcode = frame->opcode;
 
-    default:
-        log_err("unknown opcode - %d\n", frame->opcode);
-        uwsc_send_close(cl, UWSC_CLOSE_STATUS_PROTOCOL_ERR, "unknown opcode");
-        break;
+    /* Each fragment as it arrives, a compressed message once inflated */
+    if (!cl->msg.compressed &&
+        !uwsc_utf8_valid(cl, (uint8_t *)buffer_data(rb) + cl->msg.len, frame->payloadlen, frame->fin)) {
+        uwsc_fail(cl, UWSC_ERROR_PROTOCOL, UWSC_CLOSE_STATUS_INVALID_PAYLOAD, "Invalid UTF-8");
+        return false;
     }
 
-    buffer_pull(&cl->rb, NULL, frame->payloadlen);
-    cl->state = CLIENT_STATE_PARSE_MSG_HEAD;
+    cl->msg.len += frame->payloadlen;
+
+    if (!frame->fin)
+        return true;
+
+#ifdef DEFLATE_SUPPORT
+    if (cl->msg.compressed) {
+        struct buffer *ib = &cl->pmd->ib;
+
+        if (!uwsc_inflate(cl, buffer_data(rb), cl->msg.len, true, uwsc_inflate_sink))
+            return false;
+
+        if (!uwsc_utf8_valid(cl, NULL, 0, true)) {
+            uwsc_fail(cl, UWSC_ERROR_PROTOCOL, UWSC_CLOSE_STATUS_INVALID_PAYLOAD, "Invalid UTF-8");
+            return false;
+        }
+
+        uwsc_deliver(cl, buffer_data(ib), buffer_length(ib));
+
+        buffer_pull(ib, NULL, buffer_length(ib));
+    } else
+#endif
+    uwsc_deliver(cl, buffer_data(rb), cl->msg.len);
+
+    buffer_pull(rb, NULL, cl->msg.len + cl->msg.gap);
+    memset(&cl->msg, 0, sizeof(cl->msg));
 
     return true;
 }
@@ -202,6 +978,9 @@ static bool parse_frame(struct uwsc_client *cl)
     case CLIENT_STATE_PARSE_MSG_HEAD:
         if (!parse_header(cl))
             return false;
+
+        if (!(cl->frame.opcode & 0x08))
+            uwsc_touch(cl);
     case CLIENT_STATE_PARSE_MSG_PAYLEN:
         if (!parse_paylen(cl))
             return false;
@@ -215,26 +994,33 @@ static bool parse_frame(struct uwsc_client *cl)
     return true;
 }
 
-static int parse_http_header(struct uwsc_client *cl)
+/* Hand the upgrade response to onheaders, then check it */
+static int uwsc_check_response(struct uwsc_client *cl)
 {
-    char *k, *v;
+    struct http_parser *hp = &cl->handshake->http;
+    struct uwsc_header headers[HTTP_MAX_HEADERS];
+    const char *data = buffer_data(&cl->rb);
     bool has_upgrade = false;
     bool has_connection = false;
     bool has_sec_webSocket_accept = false;
+    int i;
 
-    while (1) {
-        k = strtok(NULL, "\r\n");
-        if (!k)
-            break;
-        
-        v = strchr(k, ':');
-        if (!v)
-            break;
+    for (i = 0; i < hp->nheaders; i++) {
+        headers[i].name = data + hp->headers[i].name;
+        headers[i].value = data + hp->headers[i].value;
+    }
+
+    if (cl->onheaders)
+        cl->onheaders(cl, hp->status, headers, hp->nheaders);
 
-        *v++ = 0;
+    if (hp->status != 101) {
+        log_err("Unexpected HTTP status: %d\n", hp->status);
+        return -1;
+    }
 
-        while (*v == ' ')
-            v++;
+    for (i = 0; i < hp->nheaders; i++) {
+        const char *k = headers[i].name;
+        const char *v = headers[i].value;
 
         if (!strcasecmp(k, "Upgrade") && !strcasecmp(v, "websocket"))
             has_upgrade = true;
@@ -243,25 +1029,22 @@ static int parse_http_header(struct uwsc_client *cl)
             has_connection = true;
 
         if (!strcasecmp(k, "Sec-WebSocket-Accept")) {
-            static const char *magic = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
-            struct sha1_ctx ctx;
-            unsigned char sha[20];
-            char my[512] = "";
-
-            sha1_init(&ctx);
-            sha1_update(&ctx, (uint8_t *)cl->key, strlen(cl->key));
-            sha1_update(&ctx, (uint8_t *)magic, strlen(magic));
-            sha1_final(&ctx, sha);
-
-            b64_encode(sha, sizeof(sha), my, sizeof(my));
-
-            /* verify the value of Sec-WebSocket-Accept */
-            if (strcmp(v, my)) {
+            /* Computed along with the key */
+            if (strlen(v) != HS_ACCEPT_LEN || memcmp(v, cl->handshake->accept, HS_ACCEPT_LEN)) {
                 log_err("verify Sec-WebSocket-Accept failed\n");
                 return -1;
             }
             has_sec_webSocket_accept = true;
         }
+
+        if (!strcasecmp(k, "Sec-WebSocket-Extensions")) {
+#ifdef DEFLATE_SUPPORT
+            if (cl->pmd && !pmd_accept(cl->pmd, v))
+                continue;
+#endif
+            log_err("Unexpected Sec-WebSocket-Extensions: %s\n", v);
+            return -1;
+        }
     }
 
     if (!has_upgrade || !has_connection || !has_sec_webSocket_accept)
@@ -273,6 +1056,7 @@ static int parse_http_header(struct uwsc_client *cl)
 static void uwsc_parse(struct uwsc_client *cl)
 {
     struct buffer *rb = &cl->rb;
+    int frames = 0;
     int err = 0;
 
     do {
@@ -280,42 +1064,60 @@ static void uwsc_parse(struct uwsc_client *cl)
         if (data_len == 0)
             return;
 
+        if (cl->read_paused)
+            return;
+
         if (unlikely(cl->state < CLIENT_STATE_PARSE_MSG_HEAD)) {
-            char *version, *status_code;
-            char *p, *data = buffer_data(rb);
+            int ret = http_parse(&cl->handshake->http, buffer_data(rb), data_len);
 
-            p = memmem(data, data_len, "\r\n\r\n", 4);
-            if (!p)
+            if (ret == 0)
                 return;
-            p[0] = '\0';
-
-            version = strtok(data, " ");
-            status_code = strtok(NULL, "\r\n");
 
-            if (!version || strcmp(version, "HTTP/1.1")) {
+            if (ret < 0 || uwsc_check_response(cl)) {
+                stats_add(cl, handshake_failures, 1);
                 err = UWSC_ERROR_INVALID_HEADER;
                 break;
             }
 
-            if (!status_code || atoi(status_code) != 101) {
-                err = UWSC_ERROR_INVALID_HEADER;
-                break;
-            }
+            buffer_pull(rb, NULL, cl->handshake->http.pos);
 
-            if (parse_http_header(cl)) {
-                err = UWSC_ERROR_INVALID_HEADER;
-                break;
+            free(cl->handshake);
+            cl->handshake = NULL;
+
+#ifdef DEFLATE_SUPPORT
+            /* The server declined permessage-deflate */
+            if (cl->pmd && !cl->pmd->negotiated) {
+                pmd_free(cl->pmd);
+                cl->pmd = NULL;
+
+                /* Don't offer it again when reconnecting */
+                hs_template_put(cl->hs);
+                cl->hs = NULL;
             }
+#endif
 
-            buffer_pull(rb, NULL, p - data + 4);
+            cl->state = CLIENT_STATE_PARSE_MSG_HEAD;
+            cl->retries = 0;
+            uwsc_schedule_ping(cl);
+
+            /* A stream may have been started before the handshake finished */
+            if (cl->producer)
+                ev_io_start(cl->loop, &cl->iow);
 
             if (cl->onopen)
                 cl->onopen(cl);
-
-            cl->state = CLIENT_STATE_PARSE_MSG_HEAD;
         } else {
+            if (cl->frame_budget > 0 && frames == cl->frame_budget) {
+                /* Continue on the next loop iteration so other clients get their turn */
+                cl->parse_pending = true;
+                ev_feed_event(cl->loop, &cl->ior, EV_READ);
+                return;
+            }
+
             if (!parse_frame(cl))
                 break;
+
+            frames++;
         }
        
     } while(!err);
@@ -324,25 +1126,124 @@ static void uwsc_parse(struct uwsc_client *cl)
         uwsc_error(cl, err, "Invalid header");
 }
 
-static int check_socket_state(struct uwsc_client *cl)
+/*
+ * The request is rendered once the connection is up, so that options set
+ * after uwsc_new (such as permessage-deflate) are part of it.
+ */
+static void uwsc_handshake(struct uwsc_client *cl)
 {
-    int err;
-    socklen_t optlen = sizeof(err);
+    struct buffer *wb = &cl->wb;
+    struct buffer queued = cl->wb;
+    const char *offer = "";
+    char *p;
 
-    getsockopt(cl->sock, SOL_SOCKET, SO_ERROR, &err, &optlen);
-    if (err) {
-        uwsc_error(cl, UWSC_ERROR_CONNECT, strerror(err));
-        return -1;
+    /* Messages sent before the connection was up go after the request */
+    memset(wb, 0, sizeof(struct buffer));
+
+    cl->state = CLIENT_STATE_HANDSHAKE;
+
+    if (!cl->hs) {
+#ifdef DEFLATE_SUPPORT
+        if (cl->pmd)
+            offer = cl->pmd->offer;
+#endif
+        cl->hs = hs_template_get(cl->host, cl->port, cl->path,
+            cl->extra_header ? cl->extra_header : "", offer);
+    }
+
+    if (cl->hs)
+        uwsc_buffer_prep(cl, wb, cl->hs->len + HS_KEY_LEN + 4 + buffer_length(&queued));
+
+    p = cl->hs ? buffer_put(wb, cl->hs->len + HS_KEY_LEN + 4) : NULL;
+    if (!p) {
+        cl->wb = queued;
+        uwsc_error(cl, UWSC_ERROR_IO, "Out of memory");
+        return;
+    }
+
+    memcpy(p, cl->hs->data, cl->hs->len);
+    p += cl->hs->len;
+    memcpy(p, cl->handshake->key, HS_KEY_LEN);
+    memcpy(p + HS_KEY_LEN, "\r\n\r\n", 4);
+
+    /* The request counts as the first "frame" in wb */
+    cl->wb_frame_left = buffer_length(wb);
+
+    if (buffer_length(&queued) > 0)
+        buffer_put_data(wb, buffer_data(&queued), buffer_length(&queued));
+    uwsc_buffer_release(cl, &queued);
+
+    ev_io_start(cl->loop, &cl->iow);
+}
+
+static void uwsc_connected(struct connector *c, int sock)
+{
+    struct uwsc_client *cl = c->data;
+    const char *errmsg = c->errmsg;     /* Static strings, they outlive the connector */
+    int err = c->err;
+
+    free(cl->conn);
+    cl->conn = NULL;
+
+    if (sock < 0) {
+        log_err("connect %s failed: %s\n", cl->host, errmsg);
+        uwsc_error(cl, err, errmsg);
+        return;
     }
 
+    cl->sock = sock;
+
+    if (cl->use_ssl) {
 #ifdef SSL_SUPPORT
-    if (cl->ssl)
-        cl->state = CLIENT_STATE_SSL_HANDSHAKE;
-    else
+        cl->ssl = ssl_session_new(ssl_ctx, sock);
+        if (!cl->ssl) {
+            log_err("SSL session init fail\n");
+            uwsc_error(cl, UWSC_ERROR_SSL_HANDSHAKE, "SSL session init fail");
+            return;
+        }
+
+        sslcache_resume(cl->ssl, cl->host, cl->port);
 #endif
-        cl->state = CLIENT_STATE_HANDSHAKE;
+    }
 
-    return 0;
+    ev_io_set(&cl->iow, sock, EV_WRITE);
+    ev_io_set(&cl->ior, sock, EV_READ);
+
+    if (!cl->read_paused)
+        ev_io_start(cl->loop, &cl->ior);
+
+    if (cl->ssl) {
+        cl->state = CLIENT_STATE_SSL_HANDSHAKE;
+        ev_io_start(cl->loop, &cl->iow);
+    } else {
+        uwsc_handshake(cl);
+    }
+}
+
+static void uwsc_retry_cb(struct tw_timer *t)
+{
+    struct uwsc_client *cl = container_of(t, struct uwsc_client, retry_timer);
+    int err;
+
+    cl->conn = calloc(1, sizeof(struct connector));
+    cl->handshake = calloc(1, sizeof(struct uwsc_handshake));
+    if (!cl->conn || !cl->handshake) {
+        uwsc_error(cl, UWSC_ERROR_CONNECT, strerror(errno));
+        return;
+    }
+
+    cl->conn->data = cl;
+    cl->start_time = ev_now(cl->loop);
+    tw_timer_start(&cl->timer, UWSC_MAX_CONNECT_TIME);
+
+    /* The accept value is ready by the time the server answers */
+    hs_new_key(cl->handshake->key, cl->handshake->accept);
+
+    /* The host is likely still in the resolver cache */
+    if (connector_start(cl->conn, cl->loop, cl->host, cl->port, uwsc_connected) < 0) {
+        err = cl->conn->err;
+        uwsc_error(cl, err, cl->conn->errmsg);
+    }
 }
 
 #ifdef SSL_SUPPORT
@@ -363,11 +1264,14 @@ static int ssl_negotiated(struct uwsc_client *cl)
 
     if (ret == SSL_ERROR) {
         log_err("ssl connect error(%d): %s\n", ssl_err_code, ssl_strerror(ssl_err_code, err_buf, sizeof(err_buf)));
+        stats_add(cl, handshake_failures, 1);
         uwsc_error(cl, UWSC_ERROR_SSL_HANDSHAKE, err_buf);
         return -1;
     }
 
-    cl->state = CLIENT_STATE_HANDSHAKE;
+    sslcache_handshaked(cl->ssl, cl->host, cl->port);
+
+    uwsc_handshake(cl);
 
     return 1;
 }
@@ -379,6 +1283,7 @@ static int uwsc_ssl_read(int fd, void *buf, size_t count, void *arg)
     int ret;
 
     ret = ssl_read(cl->ssl, buf, count);
+    stats_add(cl, reads, 1);
     if (ret == SSL_ERROR) {
         log_err("ssl_read(%d): %s\n", ssl_err_code,
                 ssl_strerror(ssl_err_code, err_buf, sizeof(err_buf)));
@@ -389,6 +1294,24 @@ static int uwsc_ssl_read(int fd, void *buf, size_t count, void *arg)
     if (ret == SSL_PENDING)
         return P_FD_PENDING;
 
+    stats_add(cl, bytes_read, ret);
+    return ret;
+}
+#endif
+
+#ifdef UWSC_STATS
+/* Plain reads only go through here to be counted */
+static int uwsc_plain_read(int fd, void *buf, size_t count, void *arg)
+{
+    struct uwsc_client *cl = arg;
+    ssize_t ret = read(fd, buf, count);
+
+    stats_add(cl, reads, 1);
+
+    if (ret < 0)
+        return (errno == EAGAIN || errno == EINTR) ? P_FD_PENDING : P_FD_ERR;
+
+    stats_add(cl, bytes_read, ret);
     return ret;
 }
 #endif
@@ -400,11 +1323,22 @@ static void uwsc_io_read_cb(struct ev_loop *loop, struct ev_io *w, int revents)
     bool eof;
     int ret;
 
-    if (cl->state == CLIENT_STATE_CONNECTING) {
-        if (check_socket_state(cl) < 0)
+    if (cl->parse_pending) {
+        cl->parse_pending = false;
+
+        /* Still busy with what was read before, don't take in more */
+        if (cl->read_budget && buffer_length(rb) >= cl->read_budget) {
+            uwsc_parse(cl);
             return;
+        }
     }
 
+    /* A fed event may still come after uwsc_pause_read() */
+    if (cl->read_paused)
+        return;
+
+    uwsc_buffer_prep(cl, rb, cl->read_budget ? cl->read_budget : POOL_BUF_MIN);
+
     if (cl->ssl) {
 #ifdef SSL_SUPPORT
         if (unlikely(cl->state == CLIENT_STATE_SSL_HANDSHAKE)) {
@@ -413,233 +1347,467 @@ static void uwsc_io_read_cb(struct ev_loop *loop, struct ev_io *w, int revents)
                 return;
         }
 
-        ret = buffer_put_fd_ex(rb, w->fd, 4096, &eof, uwsc_ssl_read, cl);
-        if (ret < 0)
-            return;
-#endif
-    } else {
-        ret = buffer_put_fd(rb, w->fd, -1, &eof);
-        if (ret < 0) {
-            uwsc_error(cl, UWSC_ERROR_IO, "read error");
-            return;
+        ret = buffer_put_fd_ex(rb, w->fd, cl->read_budget ? cl->read_budget : 4096,
+            &eof, uwsc_ssl_read, cl);
+        if (ret < 0)
+            return;
+#endif
+    } else {
+#ifdef UWSC_STATS
+        ret = buffer_put_fd_ex(rb, w->fd, cl->read_budget ? (ssize_t)cl->read_budget : -1, &eof,
+            uwsc_plain_read, cl);
+#else
+        ret = buffer_put_fd(rb, w->fd, cl->read_budget ? (ssize_t)cl->read_budget : -1, &eof);
+#endif
+        if (ret < 0) {
+            uwsc_error(cl, UWSC_ERROR_IO, "read error");
+            return;
+        }
+    }
+
+    stats_peak(cl, rb_peak, buffer_size(rb));
+
+    if (eof) {
+        if (uwsc_reconnect(cl, "unexpected EOF"))
+            return;
+
+        uwsc_default_free(cl);
+
+        if (cl->onclose)
+            cl->onclose(cl, UWSC_CLOSE_STATUS_ABNORMAL_CLOSE, "unexpected EOF");
+        return;
+    }
+
+    uwsc_parse(cl);
+}
+
+/*
+ * Reserve room for a whole frame in wb and fill in its header.
+ * Return where the masked payload goes.
+ */
+static uint8_t *uwsc_frame_alloc(struct uwsc_client *cl, struct buffer *wb, uint8_t head,
+    uint64_t len, const uint8_t mk[4])
+{
+    size_t hlen = 2 + 4;
+    uint8_t *p;
+    int i;
+
+    if (len > 65535)
+        hlen += 8;
+    else if (len > 125)
+        hlen += 2;
+
+    uwsc_buffer_prep(cl, wb, hlen + len);
+
+    p = buffer_put(wb, hlen + len);
+    if (!p)
+        return NULL;
+
+    stats_peak(cl, wb_peak, buffer_size(wb));
+
+    *p++ = head;
+
+    if (len < 126) {
+        *p++ = 0x80 | len;
+    } else if (len < 65536) {
+        *p++ = 0x80 | 126;
+        *p++ = len >> 8;
+        *p++ = len;
+    } else {
+        *p++ = 0x80 | 127;
+        for (i = 7; i >= 0; i--)
+            *p++ = len >> (i * 8);
+    }
+
+    memcpy(p, mk, 4);
+
+    return p + 4;
+}
+
+static int uwsc_send_frame(struct uwsc_client *cl, bool fin, int op,
+    const struct iovec *iov, int iovcnt)
+{
+    uint8_t head = (fin ? 0x80 : 0) | op;
+    uint64_t len = 0;
+    uint8_t mk[4];
+    uint8_t *p;
+    int i;
+#ifdef DEFLATE_SUPPORT
+    bool deflated = false;
+#endif
+
+    if (!(op & 0x08))
+        uwsc_touch(cl);
+
+#ifdef DEFLATE_SUPPORT
+    if (!(op & 0x08)) {
+        bool deflate = op == UWSC_OP_CONTINUE ? cl->tx_deflate : uwsc_deflate_negotiated(cl);
+        struct iovec ziov;
+
+        if (!fin)
+            cl->tx_deflate = deflate;
+
+        if (deflate) {
+            if (pmd_compress(cl->pmd, iov, iovcnt, fin) < 0)
+                return -1;
+
+            ziov.iov_base = buffer_data(&cl->pmd->ob);
+            ziov.iov_len = buffer_length(&cl->pmd->ob);
+            iov = &ziov;
+            iovcnt = 1;
+            deflated = true;
+
+            if (op != UWSC_OP_CONTINUE)
+                head |= 0x40;
         }
     }
+#endif
 
-    if (eof) {
-        uwsc_free(cl);
+    for (i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
 
-        if (cl->onclose)
-            cl->onclose(cl, UWSC_CLOSE_STATUS_ABNORMAL_CLOSE, "unexpected EOF");
-        return;
+    if (len > SIZE_MAX - 14) {
+        log_err("Payload too large\n");
+        goto err;
     }
 
-    uwsc_parse(cl);
-}
+    get_nonce(mk, 4);
 
-static void uwsc_io_write_cb(struct ev_loop *loop, struct ev_io *w, int revents)
-{
-    struct uwsc_client *cl = container_of(w, struct uwsc_client, iow);
-    int ret;
-    
-    if (cl->state == CLIENT_STATE_CONNECTING) {
-        if (check_socket_state(cl) < 0)
-            return;
+    /*
+     * Once open, Ping and Pong take the priority lane. Close stays in wb so
+     * that it still goes out after the data queued before it.
+     */
+    if ((op == UWSC_OP_PING || op == UWSC_OP_PONG) && cl->state >= CLIENT_STATE_PARSE_MSG_HEAD)
+        p = uwsc_frame_alloc(cl, &cl->cwb, head, len, mk);
+    else
+        p = uwsc_frame_alloc(cl, &cl->wb, head, len, mk);
+    if (!p) {
+        log_err("buffer_put failed\n");
+        goto err;
     }
 
-    if (cl->ssl) {
-#ifdef SSL_SUPPORT
-        static char err_buf[128];
-        struct buffer *b = &cl->wb;
+    stats_frame_out(cl, op, len);
 
-        if (unlikely(cl->state == CLIENT_STATE_SSL_HANDSHAKE)) {
-            ret = ssl_negotiated(cl);
-            if (ret <= 0)
-                return;
-        }
+    len = 0;
+    for (i = 0; i < iovcnt; i++) {
+        websocket_mask(p + len, iov[i].iov_base, iov[i].iov_len, mk, len);
+        len += iov[i].iov_len;
+    }
 
-        ret = ssl_write(cl->ssl, buffer_data(b), buffer_length(b));
-        if (ret == SSL_ERROR) {
-            log_err("ssl_write(%d): %s\n", ssl_err_code,
-                    ssl_strerror(ssl_err_code, err_buf, sizeof(err_buf)));
-            uwsc_error(cl, UWSC_ERROR_IO, err_buf);
-            return;
-        }
+    if (cl->wb_high && buffer_length(&cl->wb) >= cl->wb_high)
+        cl->wb_blocked = true;
 
-        if (ret == SSL_PENDING)
-            return;
+    uwsc_want_write(cl);
+
+    return 0;
 
-        buffer_pull(b, NULL, ret);
+err:
+#ifdef DEFLATE_SUPPORT
+    /* The compressor has taken in a payload that is never sent */
+    if (deflated)
+        pmd_discard(cl->pmd);
 #endif
+    return -1;
+}
 
-    } else {
-        ret = buffer_pull_to_fd(&cl->wb, w->fd, buffer_length(&cl->wb));
-        if (ret < 0) {
-            uwsc_error(cl, UWSC_ERROR_IO, "write error");
-            return;
-        }
+/* Refuse data while wb is above its high watermark, ondrain tells when to retry */
+static inline bool uwsc_wb_full(struct uwsc_client *cl)
+{
+    if (cl->wb_high && buffer_length(&cl->wb) >= cl->wb_high) {
+        cl->wb_blocked = true;
+        return true;
     }
 
-    if (buffer_length(&cl->wb) < 1)
-        ev_io_stop(loop, w);
+    return false;
 }
 
-static int uwsc_send(struct uwsc_client *cl, const void *data, size_t len, int op)
+/*
+ * Data messages can't be interleaved with the fragments of another one,
+ * nor with a stream whose producer hasn't sent its first chunk yet.
+ */
+static inline bool uwsc_tx_busy(struct uwsc_client *cl)
 {
-    struct buffer *wb = &cl->wb;
-    const uint8_t *p;
-    uint8_t mk[4];
-    int i;
-
-    get_nonce(mk, 4);
-
-    buffer_put_u8(wb, 0x80 | op);
+    return cl->tx_op || cl->producer;
+}
 
-    if (len < 126) {
-        buffer_put_u8(wb, 0x80 | len);
-    } else if (len < 65536) {
-        buffer_put_u8(wb, 0x80 | 126);
-        buffer_put_u16(wb, htobe16(len));
-    } else {
-        buffer_put_u8(wb, 0x80 | 127);
-        buffer_put_u64(wb, htobe64(len));
+static int uwsc_default_sendv(struct uwsc_client *cl, int op, const struct iovec *iov, int iovcnt)
+{
+    if (uwsc_tx_busy(cl) && !(op & 0x08)) {
+        log_err("A fragmented message is being sent\n");
+        return -1;
     }
 
-    buffer_put_data(wb, mk, 4);
+    if (!(op & 0x08) && uwsc_wb_full(cl))
+        return UWSC_SEND_WOULDBLOCK;
 
-    p = data;
-    for (i = 0; i < len; i++)
-        buffer_put_u8(wb, p[i] ^ mk[i % 4]);
+    return uwsc_send_frame(cl, true, op, iov, iovcnt);
+}
 
-    ev_io_start(cl->loop, &cl->iow);
+static int uwsc_default_send(struct uwsc_client *cl, const void *data, size_t len, int op)
+{
+    struct iovec iov = {
+        .iov_base = (void *)data,
+        .iov_len = len
+    };
 
-    return 0;
+    return uwsc_default_sendv(cl, op, &iov, 1);
 }
 
 int uwsc_send_ex(struct uwsc_client *cl, int op, int num, ...)
 {
-    struct buffer *wb = &cl->wb;
-    const uint8_t *p;
-    uint8_t mk[4];
-    int len = 0;
+    struct iovec iov[num > 0 && num <= IOV_MAX ? num : 1];
     va_list ap;
-    int i, j, k;
-
-    get_nonce(mk, 4);
+    int i;
 
-    buffer_put_u8(wb, 0x80 | op);
+    /* The buffers are gathered on the stack */
+    if (num < 0 || num > IOV_MAX) {
+        log_err("Invalid number of buffers: %d\n", num);
+        return -1;
+    }
 
     va_start(ap, num);
     for (i = 0; i < num; i++) {
-        len += va_arg(ap, int);
-        va_arg(ap, int);
+        iov[i].iov_len = va_arg(ap, int);
+        iov[i].iov_base = va_arg(ap, void *);
     }
     va_end(ap);
 
-    if (len < 126) {
-        buffer_put_u8(wb, 0x80 | len);
-    } else if (len < 65536) {
-        buffer_put_u8(wb, 0x80 | 126);
-        buffer_put_u16(wb, htobe16(len));
-    } else {
-        buffer_put_u8(wb, 0x80 | 127);
-        buffer_put_u64(wb, htobe64(len));
+    return cl->ops->sendv(cl, op, iov, num);
+}
+
+static int uwsc_send_fragment(struct uwsc_client *cl, bool fin, int op,
+    const void *data, size_t len)
+{
+    struct iovec iov = {
+        .iov_base = (void *)data,
+        .iov_len = len
+    };
+
+    return uwsc_send_frame(cl, fin, op, &iov, 1);
+}
+
+static int uwsc_tx_begin(struct uwsc_client *cl, int op, const void *data, size_t len)
+{
+    if (uwsc_send_fragment(cl, false, op, data, len) < 0)
+        return -1;
+
+    cl->tx_op = op;
+
+    return 0;
+}
+
+static int uwsc_tx_end(struct uwsc_client *cl, const void *data, size_t len)
+{
+    if (uwsc_send_fragment(cl, true, UWSC_OP_CONTINUE, data, len) < 0)
+        return -1;
+
+    cl->tx_op = 0;
+
+    return 0;
+}
+
+static int uwsc_default_send_begin(struct uwsc_client *cl, int op, const void *data, size_t len)
+{
+    if (uwsc_tx_busy(cl)) {
+        log_err("A fragmented message is being sent\n");
+        return -1;
     }
 
-    buffer_put_data(wb, mk, 4);
+    if (op != UWSC_OP_TEXT && op != UWSC_OP_BINARY) {
+        log_err("Only text and binary messages can be fragmented\n");
+        return -1;
+    }
 
-    k = 0;
-    va_start(ap, num);
-    for (i = 0; i < num; i++) {
-        len = va_arg(ap, int);
-        p = va_arg(ap, uint8_t *);
+    if (uwsc_wb_full(cl))
+        return UWSC_SEND_WOULDBLOCK;
 
-        for (j = 0; j < len; j++)
-            buffer_put_u8(wb, p[j] ^ mk[(k + j) % 4]);
-        k += len;
+    return uwsc_tx_begin(cl, op, data, len);
+}
+
+/* The fragments of a streamed message only come from its producer */
+static int uwsc_tx_check_continue(struct uwsc_client *cl)
+{
+    if (cl->producer) {
+        log_err("A fragmented message is being sent\n");
+        return -1;
     }
-    va_end(ap);
 
-    ev_io_start(cl->loop, &cl->iow);
+    if (!cl->tx_op) {
+        log_err("No fragmented message is being sent\n");
+        return -1;
+    }
 
     return 0;
 }
 
-static inline void uwsc_ping(struct uwsc_client *cl)
+static int uwsc_default_send_continue(struct uwsc_client *cl, const void *data, size_t len)
 {
-    const char *msg = "libuwsc";
-    cl->send(cl, msg, strlen(msg), UWSC_OP_PING);
+    if (uwsc_tx_check_continue(cl) < 0)
+        return -1;
+
+    if (uwsc_wb_full(cl))
+        return UWSC_SEND_WOULDBLOCK;
+
+    return uwsc_send_fragment(cl, false, UWSC_OP_CONTINUE, data, len);
 }
 
-static void uwsc_handshake(struct uwsc_client *cl, const char *host, int port,
-    const char *path, const char *extra_header)
+static int uwsc_default_send_end(struct uwsc_client *cl, const void *data, size_t len)
 {
-    struct buffer *wb = &cl->wb;
-    uint8_t nonce[16];
+    if (uwsc_tx_check_continue(cl) < 0)
+        return -1;
 
-    get_nonce(nonce, sizeof(nonce));
-    
-    b64_encode(nonce, sizeof(nonce), cl->key, sizeof(cl->key));
+    if (uwsc_wb_full(cl))
+        return UWSC_SEND_WOULDBLOCK;
 
-    buffer_put_printf(wb, "GET %s HTTP/1.1\r\n", path);
-    buffer_put_string(wb, "Upgrade: websocket\r\n");
-    buffer_put_string(wb, "Connection: Upgrade\r\n");
-    buffer_put_printf(wb, "Sec-WebSocket-Key: %s\r\n", cl->key);
-    buffer_put_string(wb, "Sec-WebSocket-Version: 13\r\n");
+    return uwsc_tx_end(cl, data, len);
+}
 
-    buffer_put_printf(wb, "Host: %s", host);
-    if (port == 80)
-        buffer_put_string(wb, "\r\n");
-    else
-        buffer_put_printf(wb, ":%d\r\n", port);
+/* Pull one chunk from the producer into wb */
+static void uwsc_produce(struct uwsc_client *cl)
+{
+    uint8_t buf[UWSC_STREAM_CHUNK];
+    ssize_t n;
+    int ret;
+
+    n = cl->producer(cl, buf, sizeof(buf), cl->producer_arg);
+    if (n < 0) {
+        cl->producer = NULL;
+        uwsc_fail(cl, UWSC_ERROR_IO, UWSC_CLOSE_STATUS_UNEXPECTED_CONDITION, "producer failed");
+        return;
+    }
 
-    if (extra_header && *extra_header)
-        buffer_put_string(wb, extra_header);
+    if (n == 0) {
+        cl->producer = NULL;
 
-    buffer_put_string(wb, "\r\n");
+        if (cl->tx_op)
+            ret = uwsc_tx_end(cl, NULL, 0);
+        else
+            ret = uwsc_send_fragment(cl, true, cl->producer_op, NULL, 0);
+    } else if (cl->tx_op) {
+        ret = uwsc_send_fragment(cl, false, UWSC_OP_CONTINUE, buf, n);
+    } else {
+        ret = uwsc_tx_begin(cl, cl->producer_op, buf, n);
+    }
 
-    ev_io_start(cl->loop, &cl->iow);
+    if (ret < 0)
+        uwsc_error(cl, UWSC_ERROR_IO, "buffer_put failed");
 }
 
-static void uwsc_timer_cb(struct ev_loop *loop, struct ev_timer *w, int revents)
+static int uwsc_default_send_stream(struct uwsc_client *cl, int op, uwsc_producer_t producer, void *arg)
 {
-    struct uwsc_client *cl = container_of(w, struct uwsc_client, timer);
-    ev_tstamp now = ev_now(loop);
+    if (uwsc_tx_busy(cl)) {
+        log_err("A fragmented message is being sent\n");
+        return -1;
+    }
+
+    if (op != UWSC_OP_TEXT && op != UWSC_OP_BINARY) {
+        log_err("Only text and binary messages can be streamed\n");
+        return -1;
+    }
+
+    cl->producer = producer;
+    cl->producer_arg = arg;
+    cl->producer_op = op;
+
+    uwsc_want_write(cl);
+
+    return 0;
+}
+
+static void uwsc_io_write_cb(struct ev_loop *loop, struct ev_io *w, int revents)
+{
+    struct uwsc_client *cl = container_of(w, struct uwsc_client, iow);
+    const char *err;
 
-    if (unlikely(cl->state == CLIENT_STATE_CONNECTING)) {
-        if (now - cl->start_time > UWSC_MAX_CONNECT_TIME) {
-            uwsc_error(cl, UWSC_ERROR_CONNECT, "Connect timeout");
+#ifdef SSL_SUPPORT
+    if (unlikely(cl->state == CLIENT_STATE_SSL_HANDSHAKE)) {
+        if (ssl_negotiated(cl) <= 0)
             return;
-        }
     }
+#endif
 
-    if (unlikely(cl->state < CLIENT_STATE_PARSE_MSG_HEAD))
+    if (uwsc_flush(cl, &err) < 0) {
+        uwsc_error(cl, UWSC_ERROR_IO, err);
         return;
+    }
+
+    if (cl->wb_blocked && buffer_length(&cl->wb) <= cl->wb_low) {
+        cl->wb_blocked = false;
+        if (cl->ondrain)
+            cl->ondrain(cl);
+    }
 
-    if (cl->ping_interval < 1)
+    /* Keep the writer running while a producer has more to send */
+    if (cl->producer && cl->state >= CLIENT_STATE_PARSE_MSG_HEAD) {
+        size_t len = buffer_length(&cl->wb);
+
+        if (len < UWSC_STREAM_CHUNK && (!cl->wb_high || len < cl->wb_high))
+            uwsc_produce(cl);
         return;
+    }
 
-    if (unlikely(cl->wait_pong)) {
-        if (now - cl->last_ping < 5)
-            return;
+    if (buffer_length(&cl->wb) < 1 && buffer_length(&cl->cwb) < 1)
+        ev_io_stop(loop, w);
+}
+
+static void uwsc_default_ping(struct uwsc_client *cl)
+{
+    uint8_t payload[UWSC_PING_LEN];
+
+    cl->ping_seq++;
+    cl->ping_sent = uwsc_mono_now();
+    uwsc_ping_payload(payload, cl->ping_seq, cl->ping_sent);
+
+    cl->ops->send(cl, payload, UWSC_PING_LEN, UWSC_OP_PING);
+}
+
+static void uwsc_timer_cb(struct tw_timer *t)
+{
+    struct uwsc_client *cl = container_of(t, struct uwsc_client, timer);
+    ev_tstamp now = ev_now(cl->loop);
+
+    /* Connecting, the TLS and the HTTP handshakes must be done by now */
+    if (unlikely(cl->state < CLIENT_STATE_PARSE_MSG_HEAD)) {
+        if (cl->state > CLIENT_STATE_CONNECTING)
+            stats_add(cl, handshake_failures, 1);
+        uwsc_error(cl, UWSC_ERROR_CONNECT, "Connect timeout");
+        return;
+    }
 
+    if (unlikely(cl->wait_pong)) {
         cl->wait_pong = false;
         log_err("ping timeout %d\n", ++cl->ntimeout);
+        stats_add(cl, ping_timeouts, 1);
         if (cl->ntimeout > 2) {
             uwsc_error(cl, UWSC_ERROR_PING_TIMEOUT, "ping timeout");
             return;
         }
-    } else {
-        cl->ntimeout = 0;
     }
 
-    if (now - cl->last_ping < cl->ping_interval)
+    if (now - cl->last_ping < cl->ping_interval) {
+        uwsc_schedule_ping(cl);
         return;
+    }
 
-    cl->ping(cl);
+    cl->ops->ping(cl);
     cl->last_ping = now;
     cl->wait_pong = true;
+    tw_timer_start(&cl->timer, UWSC_PONG_TIMEOUT);
 }
 
+const struct uwsc_ops uwsc_default_ops = {
+    .send = uwsc_default_send,
+    .send_ex = uwsc_send_ex,
+    .sendv = uwsc_default_sendv,
+    .send_close = uwsc_default_send_close,
+    .send_begin = uwsc_default_send_begin,
+    .send_continue = uwsc_default_send_continue,
+    .send_end = uwsc_default_send_end,
+    .send_stream = uwsc_default_send_stream,
+    .ping = uwsc_default_ping,
+    .free = uwsc_default_free
+};
+
 struct uwsc_client *uwsc_new(struct ev_loop *loop, const char *url,
     int ping_interval, const char *extra_header)
 {
@@ -659,6 +1827,18 @@ struct uwsc_client *uwsc_new(struct ev_loop *loop, const char *url,
     return cl;
 }
 
+void uwsc_delete(struct uwsc_client *cl)
+{
+    struct uwsc_pool *pool = cl->pool;
+
+    cl->ops->free(cl);
+
+    if (pool)
+        pool_client_free(pool, cl);
+    else
+        free(cl);
+}
+
 #ifdef SSL_SUPPORT
 #define SSL_CTX_CHECK                                       \
     do {                                                    \
@@ -672,70 +1852,168 @@ struct uwsc_client *uwsc_new(struct ev_loop *loop, const char *url,
     } while (0)
 #endif
 
+int uwsc_get_rtt(const struct uwsc_client *cl, struct uwsc_rtt *rtt)
+{
+    if (!cl->rtt.samples)
+        return -1;
+
+    *rtt = cl->rtt;
+
+    return 0;
+}
+
+void uwsc_pause_read(struct uwsc_client *cl)
+{
+    cl->read_paused = true;
+    ev_io_stop(cl->loop, &cl->ior);
+}
+
+void uwsc_resume_read(struct uwsc_client *cl)
+{
+    if (!cl->read_paused)
+        return;
+
+    cl->read_paused = false;
+
+    /* Not connected yet, reading starts with the connect */
+    if (cl->sock < 0)
+        return;
+
+    ev_io_start(cl->loop, &cl->ior);
+
+    /* Parse what is already buffered without waiting for the socket */
+    if (buffer_length(&cl->rb) > 0)
+        ev_feed_event(cl->loop, &cl->ior, EV_READ);
+}
+
+int uwsc_set_reconnect(struct uwsc_client *cl, const struct uwsc_reconnect *opts)
+{
+    if (!opts) {
+        memset(&cl->reconnect, 0, sizeof(cl->reconnect));
+        tw_timer_stop(&cl->retry_timer);
+        return 0;
+    }
+
+    if (opts->base_delay <= 0 || opts->max_delay < opts->base_delay || opts->max_attempts < 0) {
+        log_err("Invalid reconnect options\n");
+        return -1;
+    }
+
+    cl->reconnect = *opts;
+
+    return 0;
+}
+
+#ifdef DEFLATE_SUPPORT
+int uwsc_enable_deflate(struct uwsc_client *cl, const struct uwsc_deflate_options *opts)
+{
+    static const struct uwsc_deflate_options defaults;
+
+    if (cl->state > CLIENT_STATE_SSL_HANDSHAKE) {
+        log_err("The handshake has already been sent\n");
+        return -1;
+    }
+
+    pmd_free(cl->pmd);
+
+    hs_template_put(cl->hs);
+    cl->hs = NULL;
+
+    cl->pmd = pmd_new(opts ? opts : &defaults);
+    if (!cl->pmd) {
+        log_err("Invalid permessage-deflate options\n");
+        return -1;
+    }
+
+    return 0;
+}
+#endif
+
 int uwsc_init(struct uwsc_client *cl, struct ev_loop *loop, const char *url,
     int ping_interval, const char *extra_header)
 {
     const char *path = "/";
     char host[256] = "";
-    bool inprogress;
-    int sock = -1;
+    struct twheel *tw;
     int port;
     bool ssl;
-    int eai;
 
     memset(cl, 0, sizeof(struct uwsc_client));
 
+    cl->sock = -1;
+
     if (parse_url(url, host, sizeof(host), &port, &path, &ssl) < 0) {
         log_err("Invalid url\n");
         return -1;
     }
 
-    sock = tcp_connect(host, port, SOCK_NONBLOCK | SOCK_CLOEXEC, &inprogress, &eai);
-    if (sock < 0) {
-        log_err("tcp_connect failed: %s\n", strerror(errno));
-        return -1;
-    } else if (sock == 0) {
-        log_err("tcp_connect failed: %s\n", gai_strerror(eai));
+    if (ssl) {
+#ifdef SSL_SUPPORT
+        SSL_CTX_CHECK;
+#else
+        log_err("SSL is not enabled at compile\n");
         return -1;
+#endif
     }
 
-    if (!inprogress)
-        cl->state = CLIENT_STATE_HANDSHAKE;
-
     cl->loop = loop ? loop : EV_DEFAULT;
-    cl->sock = sock;
+    cl->ops = &uwsc_default_ops;
+#ifdef UWSC_LEGACY_API
     cl->send = uwsc_send;
     cl->send_ex = uwsc_send_ex;
     cl->send_close = uwsc_send_close;
     cl->ping = uwsc_ping;
     cl->free = uwsc_free;
+#endif
     cl->start_time = ev_now(cl->loop);
     cl->ping_interval = ping_interval;
-    if (ssl) {
-#ifdef SSL_SUPPORT
-        SSL_CTX_CHECK;
+    cl->idle_release = UWSC_IDLE_RELEASE;
+    cl->use_ssl = ssl;
+    cl->port = port;
+    cl->host = strdup(host);
+    cl->path = strdup(path);
+    if (extra_header)
+        cl->extra_header = strdup(extra_header);
+
+    cl->conn = calloc(1, sizeof(struct connector));
+    cl->handshake = calloc(1, sizeof(struct uwsc_handshake));
+
+    if (!cl->host || !cl->path || (extra_header && !cl->extra_header) || !cl->conn || !cl->handshake) {
+        log_err("malloc failed: %s\n", strerror(errno));
+        uwsc_default_free(cl);
+        return -1;
+    }
 
-        cl->ssl = ssl_session_new(ssl_ctx, sock);
-        if (!cl->ssl) {
-            log_err("SSL session init fail\n");
-            return -1;
-        }
-#else
-        log_err("SSL is not enabled at compile\n");
-        uwsc_free(cl);
+    cl->conn->data = cl;
+
+    ev_io_init(&cl->iow, uwsc_io_write_cb, -1, EV_WRITE);
+    ev_io_init(&cl->ior, uwsc_io_read_cb, -1, EV_READ);
+
+    tw = twheel_get(cl->loop);
+    if (!tw) {
+        log_err("malloc failed: %s\n", strerror(errno));
+        uwsc_default_free(cl);
         return -1;
-#endif
     }
 
-    ev_io_init(&cl->iow, uwsc_io_write_cb, sock, EV_WRITE);
+    tw_timer_init(&cl->timer, tw, uwsc_timer_cb);
+    tw_timer_init(&cl->retry_timer, tw, uwsc_retry_cb);
+    tw_timer_init(&cl->idle_timer, tw, uwsc_idle_cb);
 
-    ev_io_init(&cl->ior, uwsc_io_read_cb, sock, EV_READ);
-    ev_io_start(cl->loop, &cl->ior);
+    if (stats_register(cl) < 0) {
+        log_err("malloc failed: %s\n", strerror(errno));
+        uwsc_default_free(cl);
+        return -1;
+    }
+    tw_timer_start(&cl->timer, UWSC_MAX_CONNECT_TIME);
 
-    ev_timer_init(&cl->timer, uwsc_timer_cb, 0.0, 1.0);
-    ev_timer_start(cl->loop, &cl->timer);
+    hs_new_key(cl->handshake->key, cl->handshake->accept);
 
-    uwsc_handshake(cl, host, port, path, extra_header);
+    if (connector_start(cl->conn, cl->loop, host, port, uwsc_connected) < 0) {
+        log_err("connect %s failed: %s\n", host, cl->conn->errmsg);
+        uwsc_default_free(cl);
+        return -1;
+    }
 
     return 0;
 }
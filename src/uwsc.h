@@ -26,12 +26,34 @@
 #define _UWSC_H
 
 #include <ev.h>
+#include <sys/uio.h>
 
 #include "log.h"
 #include "config.h"
 #include "buffer.h"
+#include "timerwheel.h"
+#include "http.h"
+#include "handshake.h"
+#include "base64.h"
+#include "utf8.h"
 
 #define UWSC_MAX_CONNECT_TIME       5  /* second */
+#define UWSC_PONG_TIMEOUT           5  /* second */
+
+/* Passed to onmessage_begin when the message is fragmented */
+#define UWSC_MSG_LEN_UNKNOWN        UINT64_MAX
+
+/* Capacity rb may keep after a streamed chunk drained it */
+#define UWSC_STREAM_RB_KEEP         (64 * 1024)
+
+/* Returned by the data send functions while wb is above wb_high */
+#define UWSC_SEND_WOULDBLOCK        -2
+
+/* Size of the fragments pulled from a producer by send_stream */
+#define UWSC_STREAM_CHUNK           (16 * 1024)
+
+/* Default of idle_release, in seconds */
+#define UWSC_IDLE_RELEASE           10
 
 #ifdef __cplusplus
 extern "C" {
@@ -61,7 +83,10 @@ enum {
     UWSC_ERROR_NOT_SUPPORT,
     UWSC_ERROR_PING_TIMEOUT,
     UWSC_ERROR_CONNECT,
-    UWSC_ERROR_SSL_HANDSHAKE
+    UWSC_ERROR_SSL_HANDSHAKE,
+    UWSC_ERROR_PROTOCOL,
+    UWSC_ERROR_TOO_LARGE,
+    UWSC_ERROR_RESOLVE
 };
 
 enum {
@@ -84,46 +109,312 @@ enum {
 
 struct uwsc_frame {
     uint8_t opcode;
-    size_t payloadlen;
+    bool fin;
+    uint64_t payloadlen;
+};
+
+/* A fragmented message being reassembled at the head of rb */
+struct uwsc_message {
+    size_t len;         /* Payload bytes reassembled so far */
+    size_t gap;         /* Bytes consumed after the payload (headers, control frames) */
+    uint64_t offset;    /* Bytes already delivered through onmessage_chunk */
+    uint32_t utf8;      /* UTF-8 validation state of a text message */
+    uint8_t opcode;     /* Opcode of the first fragment, 0 if none in progress */
+    bool compressed;    /* RSV1 was set on the first fragment */
+};
+
+/* Flags of onmessage_ex */
+enum {
+    UWSC_MSG_BINARY     = 1 << 0,
+    UWSC_MSG_UTF8_VALID = 1 << 1   /* Text that was checked to be valid UTF-8 */
+};
+
+/* A response header, both strings point into the read buffer */
+struct uwsc_header {
+    const char *name;
+    const char *value;
+};
+
+struct uwsc_client;
+struct uwsc_pool;
+struct stats_loop;
+struct pmdeflate;
+struct connector;
+
+/* permessage-deflate parameters, see RFC 7692 */
+struct uwsc_deflate_options {
+    int level;                          /* zlib level 1 - 9, 0 for the zlib default */
+    int client_max_window_bits;         /* 9 - 15, 0 for 15 */
+    int server_max_window_bits;         /* 8 - 15, 0 to let the server choose */
+    bool client_no_context_takeover;    /* Reset our compressor after each message */
+    bool server_no_context_takeover;    /* Ask the server to reset its compressor */
+    bool shared_pool;                   /* Recycle zlib memory through a pool shared by all connections */
+};
+
+/* Round trip times measured with pings, in seconds */
+struct uwsc_rtt {
+    double last;
+    double avg;         /* Smoothed, weight 1/8 for a new sample */
+    double min;
+    double max;
+    double jitter;      /* Smoothed deviation from avg, weight 1/4 */
+    uint32_t samples;
+};
+
+#ifdef UWSC_STATS
+/* Frame counters are kept per opcode, in this order */
+enum {
+    UWSC_STATS_CONTINUE,
+    UWSC_STATS_TEXT,
+    UWSC_STATS_BINARY,
+    UWSC_STATS_CLOSE,
+    UWSC_STATS_PING,
+    UWSC_STATS_PONG,
+    UWSC_STATS_OPCODES
+};
+
+struct uwsc_stats {
+    uint64_t frames_in[UWSC_STATS_OPCODES];
+    uint64_t frames_out[UWSC_STATS_OPCODES];
+    uint64_t payload_in[UWSC_STATS_OPCODES];    /* Bytes as framed, so compressed */
+    uint64_t payload_out[UWSC_STATS_OPCODES];
+    uint64_t bytes_read;        /* From the socket, after TLS */
+    uint64_t bytes_written;
+    uint64_t reads;             /* read or SSL_read calls */
+    uint64_t writes;
+    uint64_t partial_writes;    /* Writes that took less than offered */
+    uint64_t rb_peak;           /* Largest capacity reached */
+    uint64_t wb_peak;
+    uint64_t reconnects;
+    uint64_t ping_timeouts;
+    uint64_t handshake_failures;    /* Refused or invalid upgrade responses, handshake timeouts */
+};
+#endif
+
+/* Automatic reconnect, see uwsc_set_reconnect */
+struct uwsc_reconnect {
+    double base_delay;      /* Backoff before the first retry in seconds */
+    double max_delay;       /* Cap of the exponential backoff */
+    int max_attempts;       /* Give up after this many retries in a row, 0 means never */
+    bool keep_queued;       /* Send the data messages not written yet after reconnecting */
+};
+
+/*
+ * Fill @buf with up to @len bytes of the message being streamed.
+ * Return the number of bytes, 0 at the end of the message or -1 on error.
+ */
+typedef ssize_t (*uwsc_producer_t)(struct uwsc_client *cl, void *buf, size_t len, void *arg);
+
+/*
+ * The operations of a client, shared by all of them through cl->ops.
+ * Use the uwsc_send() etc. wrappers below, which also honor a client
+ * pointed to a table of its own that forwards to uwsc_default_ops.
+ */
+struct uwsc_ops {
+    int (*send)(struct uwsc_client *cl, const void *data, size_t len, int op);
+    int (*send_ex)(struct uwsc_client *cl, int op, int num, ...);
+    /* Send the concatenation of @iovcnt buffers as one message without copying them first */
+    int (*sendv)(struct uwsc_client *cl, int op, const struct iovec *iov, int iovcnt);
+    int (*send_close)(struct uwsc_client *cl, int code, const char *reason);
+
+    /* Send a message of unknown size as a sequence of fragments */
+    int (*send_begin)(struct uwsc_client *cl, int op, const void *data, size_t len);
+    int (*send_continue)(struct uwsc_client *cl, const void *data, size_t len);
+    int (*send_end)(struct uwsc_client *cl, const void *data, size_t len);
+
+    /* Send a message pulled from @producer in UWSC_STREAM_CHUNK fragments as wb drains */
+    int (*send_stream)(struct uwsc_client *cl, int op, uwsc_producer_t producer, void *arg);
+    void (*ping)(struct uwsc_client *cl);
+    void (*free)(struct uwsc_client *cl);
 };
 
+extern const struct uwsc_ops uwsc_default_ops;
+
+/* Only needed until the connection is open, freed then */
+struct uwsc_handshake {
+    char key[HS_KEY_LEN];       /* Sec-WebSocket-Key */
+    char accept[HS_ACCEPT_LEN]; /* The Sec-WebSocket-Accept it must be answered with */
+    struct http_parser http;    /* Upgrade response */
+};
+
+/*
+ * What the read and write paths touch comes first, then the callbacks,
+ * then what is only used when sending streams, on timers or while
+ * connecting.
+ */
 struct uwsc_client {
     int sock;
     int state;
     struct ev_loop *loop;
-    struct ev_io ior;
-    struct ev_io iow;
+    const struct uwsc_ops *ops;
     struct buffer rb;
     struct buffer wb;
+    struct buffer cwb;      /* Control frames, flushed ahead of queued data frames */
+    size_t wb_frame_left;   /* Bytes up to the next frame boundary in wb */
     struct uwsc_frame frame;
-    struct ev_timer timer;
-    bool wait_pong;
-    int ping_interval;
-    ev_tstamp start_time;   /* Time stamp of begin connect */
-    ev_tstamp last_ping;    /* Time stamp of last ping */
-    int ntimeout;           /* Number of timeouts */
-    char key[256];          /* Sec-WebSocket-Key */
+    struct uwsc_message msg;
+    size_t max_message_size;    /* Fail with 1009 beyond this, 0 means no limit */
+    size_t read_budget;         /* Max bytes read per read event, 0 means all available */
+    int frame_budget;           /* Max frames dispatched per read event, 0 means no limit */
+    bool parse_pending;
+    bool read_paused;
+    bool skip_utf8_check;       /* Trust text messages instead of failing invalid UTF-8 with 1007 */
+    bool wb_blocked;
+    size_t wb_high;             /* Refuse data messages while wb holds this much, 0 means no limit */
+    size_t wb_low;              /* Call ondrain once a refused wb drains to this */
+    struct pmdeflate *pmd;  /* permessage-deflate state */
     void *ssl;
     void *ext;              /* User data */
+    struct ev_io ior;
+    struct ev_io iow;
 
+    /*
+     * The upgrade response is complete, called before it's checked, so also
+     * for a refused upgrade. @headers are only valid during the call.
+     */
+    void (*onheaders)(struct uwsc_client *cl, int status, const struct uwsc_header *headers, int n);
     void (*onopen)(struct uwsc_client *cl);
     void (*onmessage)(struct uwsc_client *cl, void *data, size_t len, bool binary);
+
+    /* Used instead of onmessage if set, @flags is a mask of UWSC_MSG_* */
+    void (*onmessage_ex)(struct uwsc_client *cl, void *data, size_t len, int flags);
+
+    /*
+     * Streaming delivery, opt-in by setting onmessage_chunk. Payload is handed
+     * over as it arrives and released from rb right away, onmessage is not used.
+     * @total is UWSC_MSG_LEN_UNKNOWN for a fragmented message.
+     */
+    void (*onmessage_begin)(struct uwsc_client *cl, int opcode, uint64_t total);
+    void (*onmessage_chunk)(struct uwsc_client *cl, void *data, size_t len, uint64_t offset);
+    void (*onmessage_end)(struct uwsc_client *cl);
     void (*onerror)(struct uwsc_client *cl, int err, const char *msg);
     void (*onclose)(struct uwsc_client *cl, int code, const char *reason);
+    void (*ondrain)(struct uwsc_client *cl);
+
+    /*
+     * A reconnect was scheduled in @delay seconds instead of reporting an
+     * error or a close by the server through onerror or onclose.
+     */
+    void (*onreconnect)(struct uwsc_client *cl, int attempt, double delay, const char *reason);
+
+    int tx_op;                  /* Opcode of the fragmented message being sent */
+    bool tx_deflate;            /* Its fragments are compressed */
+    int producer_op;
+    uwsc_producer_t producer;
+    void *producer_arg;
+
+    struct tw_timer timer;  /* Connect deadline, then ping and pong deadline */
+    bool wait_pong;
+    bool use_ssl;
+    bool closing;               /* Closed by us, don't reconnect */
+    int ping_interval;
+    int ntimeout;           /* Number of timeouts */
+    int port;
+    ev_tstamp start_time;   /* Time stamp of begin connect */
+    ev_tstamp last_ping;    /* Time stamp of last ping */
+    ev_tstamp last_active;  /* Time stamp of the last data frame sent or received */
+    double idle_release;    /* Give back the storage of empty buffers after this long without data, 0 to keep it */
+    struct tw_timer idle_timer;
+    struct uwsc_handshake *handshake;   /* Until the connection is open */
+    struct hs_template *hs;     /* Request up to the key */
+    char *host;
+    char *path;
+    char *extra_header;
+    struct connector *conn; /* Resolving and connecting */
+    struct uwsc_pool *pool; /* Where the struct and the buffer storage come from */
 
+    struct uwsc_reconnect reconnect;
+    struct tw_timer retry_timer;
+    int retries;                /* Reconnects since the connection was last open */
+
+    uint32_t ping_seq;          /* Carried by the last ping along with its send time */
+    double ping_sent;
+    struct uwsc_rtt rtt;        /* Reset when reconnecting */
+
+    /* The pong to our last ping came back after @rtt seconds, @stats include it */
+    void (*onrtt)(struct uwsc_client *cl, double rtt, const struct uwsc_rtt *stats);
+
+#ifdef UWSC_STATS
+    struct uwsc_stats stats;
+    struct stats_loop *stats_loop;
+    struct list_head stats_node;
+    uint32_t stats_id;          /* Tells the clients of a loop apart in the export */
+#endif
+
+#ifdef UWSC_LEGACY_API
+    /* cl->send(cl, ...) etc. of earlier versions, they call the uwsc_send() etc. wrappers */
     int (*send)(struct uwsc_client *cl, const void *data, size_t len, int op);
     int (*send_ex)(struct uwsc_client *cl, int op, int num, ...);
     int (*send_close)(struct uwsc_client *cl, int code, const char *reason);
     void (*ping)(struct uwsc_client *cl);
     void (*free)(struct uwsc_client *cl);
+#endif
 };
 
+static inline int uwsc_send(struct uwsc_client *cl, const void *data, size_t len, int op)
+{
+    return cl->ops->send(cl, data, len, op);
+}
+
+/*
+ *  uwsc_send_ex - send @num buffers as one message
+ *
+ *  Each buffer is passed as an int length followed by a pointer, e.g.
+ *  uwsc_send_ex(cl, UWSC_OP_TEXT, 2, 5, "hello", 6, " world").
+ *  Return -1 if @num is more than IOV_MAX.
+ */
+int uwsc_send_ex(struct uwsc_client *cl, int op, int num, ...);
+
+static inline int uwsc_sendv(struct uwsc_client *cl, int op, const struct iovec *iov, int iovcnt)
+{
+    return cl->ops->sendv(cl, op, iov, iovcnt);
+}
+
+static inline int uwsc_send_close(struct uwsc_client *cl, int code, const char *reason)
+{
+    return cl->ops->send_close(cl, code, reason);
+}
+
+static inline int uwsc_send_begin(struct uwsc_client *cl, int op, const void *data, size_t len)
+{
+    return cl->ops->send_begin(cl, op, data, len);
+}
+
+static inline int uwsc_send_continue(struct uwsc_client *cl, const void *data, size_t len)
+{
+    return cl->ops->send_continue(cl, data, len);
+}
+
+static inline int uwsc_send_end(struct uwsc_client *cl, const void *data, size_t len)
+{
+    return cl->ops->send_end(cl, data, len);
+}
+
+static inline int uwsc_send_stream(struct uwsc_client *cl, int op, uwsc_producer_t producer, void *arg)
+{
+    return cl->ops->send_stream(cl, op, producer, arg);
+}
+
+static inline void uwsc_ping(struct uwsc_client *cl)
+{
+    cl->ops->ping(cl);
+}
+
+/* Release what the client holds, the struct itself is left to the caller */
+static inline void uwsc_free(struct uwsc_client *cl)
+{
+    cl->ops->free(cl);
+}
+
 /*
  *  uwsc_new - creat an uwsc_client struct and connect to server
  *  @loop: If NULL will use EV_DEFAULT
  *  @url: A websock url. ws://xxx.com/xx or wss://xxx.com/xx
  *  @ping_interval: ping interval
  *  @extra_header: extra http header. Authorization: a1d4cdb1a3cd6a0e94aa3599afcddcf5\r\n
+ *
+ *  The host is resolved without blocking the loop, a failed lookup is
+ *  reported through onerror with UWSC_ERROR_RESOLVE.
  */
 struct uwsc_client *uwsc_new(struct ev_loop *loop, const char *url,
     int ping_interval, const char *extra_header);
@@ -131,10 +422,136 @@ struct uwsc_client *uwsc_new(struct ev_loop *loop, const char *url,
 int uwsc_init(struct uwsc_client *cl, struct ev_loop *loop, const char *url,
     int ping_interval, const char *extra_header);
 
+/*
+ *  uwsc_delete - free a client made by uwsc_new or uwsc_pool_client_new
+ *
+ *  Same as uwsc_free followed by free, but gives a pooled client back to
+ *  its pool. May be called from onerror and onclose.
+ */
+void uwsc_delete(struct uwsc_client *cl);
+
+/* Buffer size classes of a pool, class i holds blocks of 4 KiB << i */
+#define UWSC_POOL_CLASSES           5
+
+struct uwsc_pool_options {
+    int slab_clients;       /* Client structs allocated at once, 0 for 64 */
+    int buffer_depth;       /* Free buffers kept per size class, 0 for 256 */
+};
+
+struct uwsc_pool_stats {
+    size_t slabs;
+    size_t slab_bytes;
+    size_t clients;         /* In use */
+    size_t clients_free;    /* Slots ready in the slabs */
+    uint64_t buffer_hits;   /* Buffers served from a free list */
+    uint64_t buffer_misses; /* Allocated from the heap, no free block was cached */
+    uint64_t buffer_drops;  /* Released to the heap, too large or the free list was full */
+    size_t buffers[UWSC_POOL_CLASSES];  /* Free buffers per size class */
+    size_t buffer_bytes;    /* Held by the free lists */
+};
+
+/*
+ *  uwsc_pool_new - create a pool for the clients of @loop
+ *  @loop: If NULL will use EV_DEFAULT
+ *  @opts: NULL for the defaults
+ *
+ *  Client structs are cut from slabs and the storage of their read and
+ *  write buffers is recycled between connections instead of going through
+ *  the heap each time. A pool must only be used from its loop's thread.
+ */
+struct uwsc_pool *uwsc_pool_new(struct ev_loop *loop, const struct uwsc_pool_options *opts);
+
+/* Clients not deleted yet keep the pool alive until the last one is */
+void uwsc_pool_free(struct uwsc_pool *pool);
+void uwsc_pool_stats(const struct uwsc_pool *pool, struct uwsc_pool_stats *st);
+
+/* Like uwsc_new on the pool's loop, free the client with uwsc_delete */
+struct uwsc_client *uwsc_pool_client_new(struct uwsc_pool *pool, const char *url,
+    int ping_interval, const char *extra_header);
+
+/*
+ *  uwsc_get_rtt - the round trip times measured so far
+ *
+ *  Every ping, sent on ping_interval or with uwsc_ping, carries a sequence
+ *  number and a time stamp, and a pong that echoes them is a sample.
+ *  Return -1 if there is no sample yet.
+ */
+int uwsc_get_rtt(const struct uwsc_client *cl, struct uwsc_rtt *rtt);
+
+/*
+ *  uwsc_pause_read - stop reading from the socket and dispatching messages
+ *
+ *  Data stays in the kernel, so TCP flow control pushes back on the server.
+ */
+void uwsc_pause_read(struct uwsc_client *cl);
+void uwsc_resume_read(struct uwsc_client *cl);
+
+/*
+ *  uwsc_set_dns_ttl - set how long name lookups are cached, in seconds
+ *  @positive: for resolved hosts, default 60
+ *  @negative: for hosts that do not exist, default 5
+ *
+ *  The cache is shared by all clients. 0 disables caching, concurrent
+ *  lookups of the same host are still merged.
+ */
+void uwsc_set_dns_ttl(int positive, int negative);
+
+/*
+ *  uwsc_set_reconnect - reconnect automatically when the connection fails
+ *  @opts: NULL to turn it off
+ *
+ *  Errors and closes not asked for by us are retried after a randomized
+ *  exponential backoff, reusing the parsed url and the resolved addresses.
+ *  onopen is called again once reconnected. A message being sent with
+ *  send_begin or send_stream is abandoned. Once max_attempts retries in a
+ *  row failed the error is reported through onerror.
+ */
+int uwsc_set_reconnect(struct uwsc_client *cl, const struct uwsc_reconnect *opts);
+
+#ifdef DEFLATE_SUPPORT
+/*
+ *  uwsc_enable_deflate - offer permessage-deflate in the opening handshake
+ *  @opts: NULL for the defaults
+ *
+ *  Must be called before the loop runs the connection, e.g. right after uwsc_new.
+ */
+int uwsc_enable_deflate(struct uwsc_client *cl, const struct uwsc_deflate_options *opts);
+#endif
+
 #ifdef SSL_SUPPORT
 int uwsc_load_ca_crt_file(const char *file);
 int uwsc_load_crt_file(const char *file);
 int uwsc_load_key_file(const char *file);
+
+/* TLS sessions are cached per host:port and shared by all clients to resume handshakes */
+struct uwsc_ssl_session_stats {
+    uint64_t hits;      /* Abbreviated handshakes */
+    uint64_t misses;    /* Full handshakes */
+    int entries;        /* Sessions cached */
+};
+
+void uwsc_ssl_session_stats(struct uwsc_ssl_session_stats *st);
+#endif
+
+#ifdef UWSC_STATS
+/*
+ *  uwsc_loop_stats - the counters of all clients of @loop
+ *
+ *  Clients already freed are included. Peaks are the largest of any client,
+ *  the rest are sums.
+ */
+void uwsc_loop_stats(struct ev_loop *loop, struct uwsc_stats *st);
+
+/* Flags of uwsc_stats_render */
+#define UWSC_STATS_CLIENTS          (1 << 0)    /* Also a uwsc_client_* series per live client */
+
+/*
+ *  uwsc_stats_render - append the counters of @loop to @out in the
+ *  Prometheus text exposition format
+ *
+ *  Return 0, or -1 if @out could not grow.
+ */
+int uwsc_stats_render(struct ev_loop *loop, struct buffer *out, int flags);
 #endif
 
 #ifdef __cplusplus
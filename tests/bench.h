@@ -0,0 +1,63 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <time.h>
+
+static inline double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Keep the compiler from dropping work whose result is never read */
+static inline void bench_use(const void *p)
+{
+    __asm__ __volatile__("" : : "r"(p) : "memory");
+}
+
+/* Repeat @stmt for about @secs seconds and print the throughput, @bytes are processed per run */
+#define BENCH(name, bytes, secs, stmt)                                          \
+    do {                                                                        \
+        double b_start = bench_now(), b_elapsed;                                \
+        unsigned long b_runs = 0;                                               \
+        int b_i;                                                                \
+                                                                                \
+        do {                                                                    \
+            for (b_i = 0; b_i < 64; b_i++) {                                    \
+                stmt;                                                           \
+            }                                                                   \
+            b_runs += 64;                                                       \
+        } while ((b_elapsed = bench_now() - b_start) < (secs));                 \
+                                                                                \
+        printf("%-32s %8zu B %10.1f MB/s\n", name, (size_t)(bytes),             \
+            (double)(bytes) * b_runs / b_elapsed / 1e6);                        \
+    } while (0)
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "base64.c"
+
+static void bench(const char *name, b64_encode_blocks_t enc, b64_decode_blocks_t dec)
+{
+    /* A Sec-WebSocket-Key nonce, a SHA-1 digest for the Accept value, then bulk sizes */
+    static const size_t sizes[] = { 16, 20, 1024, 65536 };
+    static uint8_t data[65536], back[65536];
+    static char text[65536 / 3 * 4 + 4];
+    char label[64];
+    size_t i, n;
+
+    b64_encode_blocks = enc;
+    b64_decode_blocks = dec;
+
+    for (i = 0; i < 65536; i++)
+        data[i] = rand();
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        snprintf(label, sizeof(label), "b64 encode %s", name);
+        BENCH(label, sizes[i], 0.2, b64_encode_exact(data, sizes[i], text); bench_use(text));
+
+        n = b64_encode_exact(data, sizes[i], text);
+        snprintf(label, sizeof(label), "b64 decode %s", name);
+        BENCH(label, n, 0.2, b64_decode(text, n, back); bench_use(back));
+    }
+}
+
+int main(void)
+{
+    /* Resolve once so that the loops set below are not replaced */
+    b64_resolve();
+
+    bench("scalar", b64_encode_blocks_none, b64_decode_blocks_none);
+
+#ifdef B64_X86
+    if (b64_has_ssse3())
+        bench("ssse3", b64_encode_blocks_ssse3, b64_decode_blocks_ssse3);
+#endif
+
+    return 0;
+}
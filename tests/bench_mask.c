@@ -0,0 +1,80 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "mask.c"
+
+/* What websocket_mask did before it had kernels */
+static void mask_bytewise(uint8_t *dst, const uint8_t *src, size_t len, const uint8_t key[4], size_t pos)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        dst[i] = src[i] ^ key[(pos + i) & 3];
+}
+
+int main(void)
+{
+    /* A small control frame, the largest 7-bit length, and typical message sizes */
+    static const size_t sizes[] = { 16, 125, 1024, 16384, 65536 };
+    static const uint8_t key[4] = { 0x12, 0x34, 0x56, 0x78 };
+    static uint8_t src[65536], dst[65536];
+    struct {
+        const char *name;
+        mask_kernel_t kernel;
+    } impls[4];
+    char label[64];
+    int i, n = 0;
+    size_t j;
+
+    impls[n].name = "u64";
+    impls[n++].kernel = mask_u64;
+
+#ifdef MASK_X86
+#ifdef __SSE2__
+    impls[n].name = "sse2";
+    impls[n++].kernel = mask_sse2;
+#endif
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        impls[n].name = "avx2";
+        impls[n++].kernel = mask_avx2;
+    }
+#endif
+
+    for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+        BENCH("mask bytewise", sizes[j], 0.2, mask_bytewise(dst, src, sizes[j], key, 0); bench_use(dst));
+
+        for (i = 0; i < n; i++) {
+            mask_kernel = impls[i].kernel;
+            snprintf(label, sizeof(label), "mask %s", impls[i].name);
+            BENCH(label, sizes[j], 0.2, websocket_mask(dst, src, sizes[j], key, 0); bench_use(dst));
+        }
+    }
+
+    return 0;
+}
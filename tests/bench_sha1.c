@@ -0,0 +1,72 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "sha1.c"
+
+static void sha1(const void *data, size_t len, uint8_t digest[20])
+{
+    struct sha1_ctx ctx;
+
+    sha1_init(&ctx);
+    sha1_update(&ctx, data, len);
+    sha1_final(&ctx, digest);
+}
+
+static void bench(const char *name, sha1_blocks_t blocks)
+{
+    /* 60 bytes is a Sec-WebSocket-Key with the GUID, as hashed per handshake */
+    static const size_t sizes[] = { 60, 1024, 65536 };
+    static uint8_t data[65536];
+    uint8_t digest[20];
+    char label[64];
+    size_t i;
+
+    sha1_blocks_impl = blocks;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        snprintf(label, sizeof(label), "sha1 %s", name);
+        BENCH(label, sizes[i], 0.3, sha1(data, sizes[i], digest); bench_use(digest));
+    }
+}
+
+int main(void)
+{
+    bench("generic", sha1_blocks_generic);
+
+#ifdef SHA1_X86
+    if (sha1_has_shani())
+        bench("shani", sha1_blocks_shani);
+#endif
+
+#ifdef SHA1_ARM
+    if (getauxval(AT_HWCAP) & HWCAP_SHA1)
+        bench("armv8", sha1_blocks_armv8);
+#endif
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Included to test each kernel, not only the one selected for this CPU */
+#include "mask.c"
+
+struct mask_impl {
+    const char *name;
+    mask_kernel_t kernel;
+};
+
+static int mask_impls(struct mask_impl *impls)
+{
+    int n = 0;
+
+    impls[n++] = (struct mask_impl){ "u64", mask_u64 };
+
+#ifdef MASK_X86
+#ifdef __SSE2__
+    impls[n++] = (struct mask_impl){ "sse2", mask_sse2 };
+#endif
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        impls[n++] = (struct mask_impl){ "avx2", mask_avx2 };
+#endif
+
+    return n;
+}
+
+static void mask_ref(uint8_t *dst, const uint8_t *src, size_t len, const uint8_t key[4], size_t pos)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        dst[i] = src[i] ^ key[(pos + i) & 3];
+}
+
+/* Every alignment of source and destination, key phase and length up to a few blocks */
+static int check(const struct mask_impl *impl)
+{
+    static const uint8_t key[4] = { 0x12, 0x34, 0x56, 0x78 };
+    static uint8_t src[1024 + 64], dst[1024 + 64], want[1024 + 64];
+    size_t sa, da, pos, len;
+
+    mask_kernel = impl->kernel;
+
+    for (len = 0; len < sizeof(src) - 64; len = len < 200 ? len + 1 : len * 2 + 1) {
+        for (sa = 0; sa < 8; sa++) {
+            for (da = 0; da < 8; da++) {
+                for (pos = 0; pos < 4; pos++) {
+                    size_t i;
+
+                    for (i = 0; i < len; i++)
+                        src[sa + i] = rand();
+
+                    /* Guard bytes around the output must survive */
+                    memset(dst, 0xAA, sizeof(dst));
+                    memset(want, 0xAA, sizeof(want));
+                    mask_ref(want + da, src + sa, len, key, pos);
+                    websocket_mask(dst + da, src + sa, len, key, pos);
+
+                    if (memcmp(dst, want, sizeof(dst))) {
+                        printf("%s: len %zu src +%zu dst +%zu pos %zu\n", impl->name, len, sa, da, pos);
+                        return 1;
+                    }
+
+                    /* In place */
+                    memcpy(dst + da, src + sa, len);
+                    websocket_mask(dst + da, dst + da, len, key, pos);
+
+                    if (memcmp(dst, want, sizeof(dst))) {
+                        printf("%s: in place, len %zu dst +%zu pos %zu\n", impl->name, len, da, pos);
+                        return 1;
+                    }
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+int main(void)
+{
+    struct mask_impl impls[3];
+    int fails = 0;
+    int i, n;
+
+    n = mask_impls(impls);
+
+    for (i = 0; i < n; i++) {
+        int f = check(&impls[i]);
+
+        printf("%-8s %s\n", impls[i].name, f ? "FAIL" : "ok");
+        fails += f;
+    }
+
+    return fails ? EXIT_FAILURE : EXIT_SUCCESS;
+}
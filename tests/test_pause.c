@@ -0,0 +1,243 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "uwsc.h"
+#include "sha1.h"
+#include "base64.h"
+
+/*
+ * A server on the loopback answers the handshake and sends all the messages
+ * in the same write, so they are buffered by the client when the first one
+ * pauses reading from inside onmessage.
+ */
+
+#define NMSG    4
+
+static int lfd = -1;
+static int sfd = -1;
+static ev_io srv_w;
+static ev_timer pause_timer;
+static ev_timer guard_timer;
+static char req[4096];
+static size_t reqlen;
+
+static bool paused;
+static int received;
+static int fails;
+
+static int accept_value(const char *req, char *accept, size_t size)
+{
+    static const char *magic = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    const char *key = strstr(req, "Sec-WebSocket-Key:");
+    struct sha1_ctx ctx;
+    uint8_t sha[20];
+    size_t len;
+
+    if (!key)
+        return -1;
+
+    key += strlen("Sec-WebSocket-Key:");
+    while (*key == ' ')
+        key++;
+
+    len = strcspn(key, "\r\n");
+
+    sha1_init(&ctx);
+    sha1_update(&ctx, key, len);
+    sha1_update(&ctx, magic, strlen(magic));
+    sha1_final(&ctx, sha);
+
+    return b64_encode(sha, sizeof(sha), accept, size) < 0 ? -1 : 0;
+}
+
+static void srv_read_cb(struct ev_loop *loop, ev_io *w, int revents)
+{
+    char accept[64], out[512];
+    ssize_t n;
+    int len, i;
+
+    n = read(w->fd, req + reqlen, sizeof(req) - 1 - reqlen);
+    if (n <= 0) {
+        ev_io_stop(loop, w);
+        return;
+    }
+
+    reqlen += n;
+    req[reqlen] = '\0';
+
+    if (!strstr(req, "\r\n\r\n"))
+        return;
+
+    /* Only the handshake is read, the client's Close is not answered */
+    ev_io_stop(loop, w);
+
+    if (accept_value(req, accept, sizeof(accept)) < 0) {
+        printf("no Sec-WebSocket-Key in the request\n");
+        fails++;
+        ev_break(loop, EVBREAK_ALL);
+        return;
+    }
+
+    len = snprintf(out, sizeof(out), "HTTP/1.1 101 Switching Protocols\r\n"
+        "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: %s\r\n\r\n", accept);
+
+    for (i = 0; i < NMSG; i++) {
+        out[len++] = 0x81;
+        out[len++] = 1;
+        out[len++] = '1' + i;
+    }
+
+    if (write(w->fd, out, len) != len) {
+        printf("write to the client failed\n");
+        fails++;
+        ev_break(loop, EVBREAK_ALL);
+    }
+}
+
+static void srv_accept_cb(struct ev_loop *loop, ev_io *w, int revents)
+{
+    sfd = accept(w->fd, NULL, NULL);
+    if (sfd < 0)
+        return;
+
+    ev_io_stop(loop, w);
+
+    ev_io_init(&srv_w, srv_read_cb, sfd, EV_READ);
+    ev_io_start(loop, &srv_w);
+}
+
+static void pause_timer_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+    struct uwsc_client *cl = w->data;
+
+    paused = false;
+    uwsc_resume_read(cl);
+}
+
+static void guard_timer_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+    printf("timed out with %d of %d messages\n", received, NMSG);
+    fails++;
+    ev_break(loop, EVBREAK_ALL);
+}
+
+static void onmessage(struct uwsc_client *cl, void *data, size_t len, bool binary)
+{
+    received++;
+
+    if (paused) {
+        printf("message %d delivered while paused\n", received);
+        fails++;
+    }
+
+    if (len != 1 || *(char *)data != '0' + received) {
+        printf("message %d out of order\n", received);
+        fails++;
+    }
+
+    /*
+     * Pause with frames still in rb, the second time right after the
+     * event fed by uwsc_resume_read() delivered a message.
+     */
+    if (received == 1 || received == 3) {
+        uwsc_pause_read(cl);
+        paused = true;
+        ev_timer_set(&pause_timer, 0.2, 0);
+        ev_timer_start(cl->loop, &pause_timer);
+        return;
+    }
+
+    if (received == NMSG)
+        ev_break(cl->loop, EVBREAK_ALL);
+}
+
+static void onerror(struct uwsc_client *cl, int err, const char *msg)
+{
+    printf("onerror %d: %s\n", err, msg);
+    fails++;
+    ev_break(cl->loop, EVBREAK_ALL);
+}
+
+int main(void)
+{
+    struct ev_loop *loop = EV_DEFAULT;
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+    };
+    socklen_t addrlen = sizeof(addr);
+    struct uwsc_client *cl;
+    ev_io accept_w;
+    char url[64];
+
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 1) < 0 ||
+        getsockname(lfd, (struct sockaddr *)&addr, &addrlen) < 0) {
+        perror("listen");
+        return EXIT_FAILURE;
+    }
+
+    ev_io_init(&accept_w, srv_accept_cb, lfd, EV_READ);
+    ev_io_start(loop, &accept_w);
+
+    snprintf(url, sizeof(url), "ws://127.0.0.1:%d/", ntohs(addr.sin_port));
+
+    cl = uwsc_new(loop, url, 0, NULL);
+    if (!cl)
+        return EXIT_FAILURE;
+
+    /* One frame per read event, so buffered frames go through fed events */
+    cl->frame_budget = 1;
+    cl->onmessage = onmessage;
+    cl->onerror = onerror;
+
+    ev_init(&pause_timer, pause_timer_cb);
+    pause_timer.data = cl;
+
+    ev_timer_init(&guard_timer, guard_timer_cb, 5, 0);
+    ev_timer_start(loop, &guard_timer);
+
+    ev_run(loop, 0);
+
+    if (received != NMSG && !fails) {
+        printf("%d of %d messages delivered\n", received, NMSG);
+        fails++;
+    }
+
+    printf("pause %s\n", fails ? "FAIL" : "ok");
+
+    uwsc_delete(cl);
+    close(sfd);
+    close(lfd);
+
+    return fails ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,176 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Jianhui Zhao <zhaojh329@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Included to test each block implementation, not only the one selected for this CPU */
+#include "sha1.c"
+
+struct sha1_impl {
+    const char *name;
+    sha1_blocks_t blocks;
+};
+
+struct sha1_vector {
+    const char *msg;
+    size_t repeat;
+    const char *digest;
+};
+
+/* FIPS 180-2 appendix A and the SHAVS long message test */
+static const struct sha1_vector vectors[] = {
+    { "", 1, "da39a3ee5e6b4b0d3255bfef95601890afd80709" },
+    { "abc", 1, "a9993e364706816aba3e25717850c26c9cd0d89d" },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+      "84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+    { "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+      "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu", 1,
+      "a49b2446a02c645bf419f995b67091253a04a259" },
+    { "a", 1000000, "34aa973cd4c4daa4f61eeb2bdbad27316534016f" },
+    { "0123456701234567012345670123456701234567012345670123456701234567", 10,
+      "dea356a2cddd90c7a7ecedc5ebb563934f460452" },
+    { "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmno", 16777216,
+      "7789f0c9ef7bfc40d93311143dfbe69e2017f592" }
+};
+
+static int sha1_impls(struct sha1_impl *impls)
+{
+    int n = 0;
+
+    impls[n++] = (struct sha1_impl){ "generic", sha1_blocks_generic };
+
+#ifdef SHA1_X86
+    if (sha1_has_shani())
+        impls[n++] = (struct sha1_impl){ "shani", sha1_blocks_shani };
+#endif
+
+#ifdef SHA1_ARM
+    if (getauxval(AT_HWCAP) & HWCAP_SHA1)
+        impls[n++] = (struct sha1_impl){ "armv8", sha1_blocks_armv8 };
+#endif
+
+    return n;
+}
+
+static void hex(const uint8_t digest[20], char *out)
+{
+    int i;
+
+    for (i = 0; i < 20; i++)
+        sprintf(out + i * 2, "%02x", digest[i]);
+}
+
+static int check_vectors(const struct sha1_impl *impl)
+{
+    static uint8_t chunk[1 << 16];
+    int fails = 0;
+    size_t i, j;
+
+    sha1_blocks_impl = impl->blocks;
+
+    for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        const struct sha1_vector *v = &vectors[i];
+        size_t len = strlen(v->msg);
+        size_t per = len ? sizeof(chunk) / len : 1;
+        struct sha1_ctx ctx;
+        uint8_t digest[20];
+        char out[41];
+
+        /* Repeated messages are fed many copies at a time, as large updates */
+        for (j = 0; j < per; j++)
+            memcpy(chunk + j * len, v->msg, len);
+
+        sha1_init(&ctx);
+        for (j = 0; j < v->repeat; j += per)
+            sha1_update(&ctx, chunk, len * (v->repeat - j < per ? v->repeat - j : per));
+        sha1_final(&ctx, digest);
+
+        hex(digest, out);
+        if (strcmp(out, v->digest)) {
+            printf("%s: vector %zu: got %s, want %s\n", impl->name, i, out, v->digest);
+            fails++;
+        }
+    }
+
+    return fails;
+}
+
+/* Odd lengths fed in odd pieces must hash the same as the generic code in one piece */
+static int check_random(const struct sha1_impl *impl)
+{
+    static uint8_t data[4096];
+    uint8_t want[20], got[20];
+    struct sha1_ctx ctx;
+    size_t len, off, n;
+    int round;
+
+    srand(1);
+
+    for (round = 0; round < 2000; round++) {
+        len = rand() % sizeof(data);
+        for (off = 0; off < len; off++)
+            data[off] = rand();
+
+        sha1_blocks_impl = sha1_blocks_generic;
+        sha1_init(&ctx);
+        sha1_update(&ctx, data, len);
+        sha1_final(&ctx, want);
+
+        sha1_blocks_impl = impl->blocks;
+        sha1_init(&ctx);
+        for (off = 0; off < len; off += n) {
+            n = rand() % 200;
+            if (n > len - off)
+                n = len - off;
+            sha1_update(&ctx, data + off, n);
+        }
+        sha1_final(&ctx, got);
+
+        if (memcmp(want, got, 20)) {
+            printf("%s: mismatch at length %zu\n", impl->name, len);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int main(void)
+{
+    struct sha1_impl impls[3];
+    int fails = 0;
+    int i, n;
+
+    n = sha1_impls(impls);
+
+    for (i = 0; i < n; i++) {
+        int f = check_vectors(&impls[i]) + check_random(&impls[i]);
+
+        printf("%-8s %s\n", impls[i].name, f ? "FAIL" : "ok");
+        fails += f;
+    }
+
+    return fails ? EXIT_FAILURE : EXIT_SUCCESS;
+}